@@ -3,13 +3,27 @@
 #
 # Utility to decode the contents of EEPROM read from a radio
 #
+# With no arguments, reads one dump from stdin and prints it:
+#	dump_eeprom.py <py-WAPP.hex
+#
+# Given files or directories, decodes every dump in them (directories are
+# walked for *.eep and *.hex) into one row per file, keyed by the file name,
+# and writes CSV (default) or JSON to stdout or the -o file:
+#	dump_eeprom.py -j -o returns.json "Unmodifed Unit Dump"
+# Dumps that won't parse get a row with just the error, so one bad file
+# doesn't stop a run.
+#
 # TODO:
-#	- add command line args via getopt to tailor output and input
 #	- decode fields into human readable form
 
 from intelhex import IntelHex
 from struct import unpack_from, unpack
 from crcmod.predefined import Crc
+from getopt import getopt, GetoptError
+from collections import OrderedDict
+import csv
+import json
+import os
 import sys
 
 eyecatcher='The Public Radio'
@@ -30,12 +44,63 @@ def calc_freq(band, spacing, chan):
 	s = step[spacing]
 	return b + (float(chan) / s)
 
-def dump_freq(info, crc):
+# Working and factory blocks, must match EEPROM_WORKING and EEPROM_FACTORY in firmware
+
+working_base = 0
+factory_base = 16
+
+# Manufacturing record, only there if eeprom.py was run with -M
+
+manuf_base = 32
+manuf_size = 51
+
+# Bandgap calibration, only there if eeprom.py was run with -B. Must match
+# EEPROM_CALIBRATION in firmware, which uses the nominal bandgap without it.
+
+calibration_base = 92
+bandgap_nominal = 1100
+bandgap_range = (950, 1250)
+
+# Channel save ring written by the firmware. Must match EEPROM_RING in firmware.
+# The number of slots depends on the part (2 on attiny25, 4 otherwise), which we
+# guess from how much data there is.
+
+ring_base = 96
+ring_size = 16
+
+# Scanned station table, only on parts with more than 128 bytes of EEPROM.
+# Must match EEPROM_STATIONS in firmware.
+
+stations_base = 160
+stations_max = 15
+
+# Field telemetry ring, only on parts with more than 128 bytes of EEPROM.
+# Must match Telemetry.h and EEPROM_TELEMETRY in firmware. eeprom.py images
+# don't touch it, so it keeps counting across reprogramming.
+
+telemetry_base = 192
+telemetry_size = 10
+telemetry_slots = 3
+vcc_oversample = 8		# VCC_OVERSAMPLE in VccADC.h
+vcc_shift = 5			# TELEMETRY_VCC_SHIFT in Telemetry.h
+
+# Phase profiler record, only written by PROFILE firmware builds.
+# Must match Profile.h and EEPROM_PROFILE in firmware.
 
+profile_base = 224
+profile_size = 32
+profile_phases = ['si4702_init', 'si4702_enable', 'si4702_tune', 'ADC check', 'Button']
+profile_tick_ms = 0.256		# Timer0 at 1MHz/256
+sleep_tick_ms = 16		# WDT
+
+def crc_ok(info, crc):
 	crc16 = Crc('crc-16')
 	crc16.update(info)
+	return crc16.crcValue == crc
+
+def dump_freq(info, crc, name):
 
-	if (crc16.crcValue != crc):
+	if not crc_ok(info, crc):
 		print "%s: CRC mismatch" % name
 	else:
 		(band, deemph, spacing, chan, vol) = unpack('<BBBHB8x', info)
@@ -49,33 +114,403 @@ def dump_freq(info, crc):
 		try:
 			freq = calc_freq(band, spacing, chan)
 			print "    Freqency=%03.02f Mhz (calculated)" % freq
-			
-		except:	
+
+		except:
 			print "%s: Cannot decode frequency" % name
-		
-		
-dump=IntelHex(source)
 
-# Unpack fields
-# 14 - String - Working station
-#  2 = HEX    - Working CRC
-# 14 - String - Factory station
-#  2 = HEX    - Factory CRC
+def ring_slots(data):
+	return min(max(len(data) - ring_base, 0) / ring_size, 4)
+
+# Find the ring record the firmware would boot from: newest sequence number with a good CRC.
+# Sequence numbers wrap, so compare them as signed 8 bit differences like the firmware does.
+# Returns (slot, sequence), or None if no slot is good.
+
+def active_slot(data):
+
+	active = None
+
+	for i in range(ring_slots(data)):
+		(info, crc) = unpack_from('<14sH', data, ring_base + (ring_size * i))
+		if crc_ok(info, crc):
+			seq = ord(info[13])
+			if active is None or ((seq - active[1]) & 0xff) in range(1, 128):
+				active = (i, seq)
+
+	return active
+
+# Band and spacing the firmware is running with, for decoding the station table
+
+def running_band(data):
+
+	active = active_slot(data)
+
+	if active is not None:
+		return unpack_from('<BxB', data, ring_base + (ring_size * active[0]))
+
+	(info, crc) = unpack_from('<14sH', data, working_base)
+	if crc_ok(info, crc):
+		return unpack_from('<BxB', data, working_base)
+
+	return (0, 0)
+
+# Channels in the station table, or None if there isn't one or it hasn't been scanned
+
+def stations(data):
+
+	if len(data) < stations_base + 1 + (2 * stations_max):
+		return None
+
+	count = ord(data[stations_base])
+	if count == 0 or count > stations_max:
+		return None
+
+	return unpack_from('<%dH' % count, data, stations_base + 1)
+
+def blank(data, offset, size):
+	return data[offset:offset + size] == '\xff' * size
+
+# The calibrated bandgap in mV, 'blank' if there is no record, or None if the
+# record is bad (the firmware treats both as nominal)
+
+def bandgap(data):
+
+	if len(data) < calibration_base + 4 or blank(data, calibration_base, 4):
+		return 'blank'
+
+	(mv, check) = unpack_from('<HH', data, calibration_base)
+
+	if check != (~mv & 0xffff) or mv < bandgap_range[0] or mv > bandgap_range[1]:
+		return None
+
+	return mv
+
+# The newest good telemetry record as (boots, seeks, vcc reading, low battery, crc fails),
+# or None if there isn't one. Sequence numbers wrap, so compare them as signed 8 bit
+# differences like the firmware does.
+
+def telemetry(data):
+
+	if len(data) < telemetry_base + (telemetry_size * telemetry_slots):
+		return None
+
+	newest = None
+
+	for i in range(telemetry_slots):
+		(info, crc) = unpack_from('<8sH', data, telemetry_base + (telemetry_size * i))
+		if crc_ok(info, crc):
+			record = unpack('<BHHBBB', info)
+			if newest is None or ((record[0] - newest[0]) & 0xff) in range(1, 128):
+				newest = record
+
+	if newest is None:
+		return None
+
+	(seq, boots, seeks, vcc, low, fails) = newest
+
+	return (boots, seeks, vcc << vcc_shift, low, fails)
+
+# Volts from a readVcc() reading, with the unit's bandgap if it has a good one
+
+def vcc_volts(data, reading):
+
+	mv = bandgap(data)
+	if mv is None or mv == 'blank':
+		mv = bandgap_nominal
+
+	if not reading:
+		return None
+
+	reading += 1 << (vcc_shift - 1)		# Middle of the step the firmware rounded down to
+
+	return round(mv * 1023.0 * vcc_oversample / reading / 1000.0, 2)
+
+def print_dump(data):
 
-#payload = list(unpack_from('<14sH14sH17sBB2s13s17s', dump.tobinstr()))
-payload = list(unpack_from('<14sH', dump.tobinstr()))
+	payload = list(unpack_from('<14sH14sH', data))
 
-#if not (eyecatcher in payload[9]):
-	#print "NOTE:Eyecatcher text string not found"
+	print "---Working"
+	dump_freq(payload[0], payload[1], "Working")
+	print "---Factory"
+	dump_freq(payload[2], payload[3], "Factory")
 
+	slots = ring_slots(data)
+	active = active_slot(data)
 
-print "---Working"
-dump_freq(payload[0], payload[1])
-print "---Factory"
-dump_freq(payload[2], payload[3])
+	for i in range(slots):
+		(info, crc) = unpack_from('<14sH', data, ring_base + (ring_size * i))
+		if info == '\xff' * 14 and crc == 0xffff:
+			print "---Ring slot %d: empty" % i
+			continue
+		mark = ""
+		if active is not None and active[0] == i:
+			mark = " (active)"
+		print "---Ring slot %d: sequence %d%s" % (i, ord(info[13]), mark)
+		dump_freq(info, crc, "Ring slot %d" % i)
+
+	if slots and active is None:
+		print "NOTE: No good ring records, running from Working"
+
+	mv = bandgap(data)
+	if mv is None:
+		print "NOTE: Bad bandgap calibration, running with %d mV" % bandgap_nominal
+	elif mv != 'blank':
+		print "---Bandgap: %d mV" % mv
+
+	if len(data) >= stations_base + 1 + (2 * stations_max):
+		chans = stations(data)
+		if chans is None:
+			print "---Stations: not scanned yet"
+		else:
+			print "---Stations: %d" % len(chans)
+			(band, spacing) = running_band(data)
+			for chan in chans:
+				try:
+					print "    Channel:    %.3d = %03.02f Mhz (calculated)" % (chan, calc_freq(band, spacing, chan))
+				except:
+					print "    Channel:    %.3d" % chan
+
+	record = telemetry(data)
+	if record is not None:
+		(boots, seeks, vcc, low, fails) = record
+		print "---Telemetry"
+		print "    Boots:        %5d" % boots
+		print "    Seeks:        %5d" % seeks
+		print "    Low battery:  %5d" % low
+		print "    CRC failures: %5d" % fails
+		volts = vcc_volts(data, vcc)
+		if volts is not None:
+			print "    Last Vcc:     %5.2f V" % volts
+
+	if len(data) >= profile_base + profile_size and not blank(data, profile_base, profile_size):
+		fields = unpack_from('<%dHIIHH' % (2 * len(profile_phases)), data, profile_base)
+		(awake, sleep, sleeps, boot_ms) = fields[-4:]
+		awake_ms = awake * profile_tick_ms
+		sleep_ms = sleep * sleep_tick_ms
+		print "---Profile"
+		for i in range(len(profile_phases)):
+			(count, ticks) = fields[2 * i:2 * i + 2]
+			avg = 0.0
+			if count:
+				avg = ticks * profile_tick_ms / count
+			print "    %-14s %5d calls %9.1f ms awake, %7.1f ms avg" % (profile_phases[i] + ':', count, ticks * profile_tick_ms, avg)
+		print "    Awake:      %10.1f ms" % awake_ms
+		print "    Asleep:     %10.1f ms in %d sleeps" % (sleep_ms, sleeps)
+		if awake_ms + sleep_ms:
+			print "    Duty cycle: %10.3f %% awake" % (100.0 * awake_ms / (awake_ms + sleep_ms))
+		print "    Boot to audio: %d ms" % boot_ms
+
+	if len(data) >= manuf_base + manuf_size:
+
+		manuf = unpack_from('17sBB2s13s17s', data, manuf_base)
+
+		if not (eyecatcher in manuf[5]):
+			print "NOTE:Eyecatcher text string not found"
+
+		print "SN: %s" % manuf[0].strip('\000')
+		print "WW: %d" % manuf[1]
+		print "YY: %d" % manuf[2]
+		print "Station: %s" % manuf[3]
+		print "Campaign: %s" % manuf[4].strip('\000')
+
+#
+# Bulk decoding. Every row has all the columns, empty where a dump doesn't
+# have that record, so the CSV lines up and the JSON is easy to filter.
+#
+
+columns = ['file', 'error', 'size', 'boot', 'boot_channel', 'boot_freq']
+for block in ['working', 'factory']:
+	columns += [block + '_' + f for f in ['crc', 'band', 'deemphasis', 'spacing', 'channel', 'volume', 'freq']]
+columns += ['ring_slots', 'ring_good', 'ring_active', 'ring_sequence', 'stations', 'bandgap_mv',
+	'sn', 'ww', 'yy', 'ts', 'campaign', 'eyecatcher', 'profile_boot_ms', 'profile_duty',
+	'telemetry_boots', 'telemetry_seeks', 'telemetry_low_battery', 'telemetry_crc_fails', 'telemetry_vcc']
+
+# Strings from the manufacturing record, escaped so junk in a bad dump still
+# comes out as something readable that CSV and JSON can carry
+
+def text(s):
+	return s.strip('\000').encode('string_escape')
+
+# crc is 'ok', 'bad', or 'blank' for an erased block
+
+def decode_block(data, offset, prefix, row):
+
+	(info, crc) = unpack_from('<14sH', data, offset)
+
+	if blank(data, offset, ring_size):
+		row[prefix + 'crc'] = 'blank'
+		return False
+
+	if not crc_ok(info, crc):
+		row[prefix + 'crc'] = 'bad'
+		return False
+
+	(band, deemph, spacing, chan, vol) = unpack('<BBBHB8x', info)
+
+	row[prefix + 'crc'] = 'ok'
+	row[prefix + 'band'] = band
+	row[prefix + 'deemphasis'] = deemph
+	row[prefix + 'spacing'] = spacing
+	row[prefix + 'channel'] = chan
+	row[prefix + 'volume'] = vol
+
+	try:
+		row[prefix + 'freq'] = round(calc_freq(band, spacing, chan), 2)
+	except:
+		pass
+
+	return True
+
+def decode(data):
+
+	row = OrderedDict((c, '') for c in columns)
+
+	row['size'] = len(data)
+
+	if len(data) < factory_base + ring_size:
+		row['error'] = 'too short'
+		return row
+
+	good = {}
+	for (name, offset) in [('working', working_base), ('factory', factory_base)]:
+		good[name] = decode_block(data, offset, name + '_', row)
+
+	slots = ring_slots(data)
+	active = active_slot(data)
+
+	row['ring_slots'] = slots
+	row['ring_good'] = len([i for i in range(slots) if crc_ok(*unpack_from('<14sH', data, ring_base + (ring_size * i)))])
+
+	# Same order the firmware tries them in at boot: ring, working, then a copy of factory
+
+	boot = {}
+	if active is not None:
+		row['ring_active'] = active[0]
+		row['ring_sequence'] = active[1]
+		decode_block(data, ring_base + (ring_size * active[0]), '', boot)
+		row['boot'] = 'ring %d' % active[0]
+	elif good['working']:
+		boot = {'channel': row['working_channel'], 'freq': row['working_freq']}
+		row['boot'] = 'working'
+	elif good['factory']:
+		boot = {'channel': row['factory_channel'], 'freq': row['factory_freq']}
+		row['boot'] = 'factory'
+	else:
+		row['boot'] = 'none'
+
+	row['boot_channel'] = boot.get('channel', '')
+	row['boot_freq'] = boot.get('freq', '')
+
+	chans = stations(data)
+	if chans is not None:
+		row['stations'] = len(chans)
+
+	mv = bandgap(data)
+	if mv is None:
+		row['bandgap_mv'] = 'bad'
+	elif mv != 'blank':
+		row['bandgap_mv'] = mv
+
+	if len(data) >= manuf_base + manuf_size and not blank(data, manuf_base, manuf_size):
+		manuf = unpack_from('17sBB2s13s17s', data, manuf_base)
+		row['sn'] = text(manuf[0])
+		row['ww'] = manuf[1]
+		row['yy'] = manuf[2]
+		row['ts'] = text(manuf[3])
+		row['campaign'] = text(manuf[4])
+		row['eyecatcher'] = eyecatcher in manuf[5]
+
+	if len(data) >= profile_base + profile_size and not blank(data, profile_base, profile_size):
+		fields = unpack_from('<%dHIIHH' % (2 * len(profile_phases)), data, profile_base)
+		(awake, sleep, sleeps, boot_ms) = fields[-4:]
+		awake_ms = awake * profile_tick_ms
+		sleep_ms = sleep * sleep_tick_ms
+		row['profile_boot_ms'] = boot_ms
+		if awake_ms + sleep_ms:
+			row['profile_duty'] = round(100.0 * awake_ms / (awake_ms + sleep_ms), 3)
+
+	record = telemetry(data)
+	if record is not None:
+		(boots, seeks, vcc, low, fails) = record
+		row['telemetry_boots'] = boots
+		row['telemetry_seeks'] = seeks
+		row['telemetry_low_battery'] = low
+		row['telemetry_crc_fails'] = fails
+		volts = vcc_volts(data, vcc)
+		if volts is not None:
+			row['telemetry_vcc'] = volts
+
+	return row
+
+def dump_files(paths):
+
+	for path in paths:
+		if os.path.isdir(path):
+			for (dirpath, dirnames, filenames) in os.walk(path):
+				dirnames.sort()
+				for name in sorted(filenames):
+					if os.path.splitext(name)[1].lower() in ['.eep', '.hex']:
+						yield os.path.join(dirpath, name)
+		else:
+			yield path
+
+def bulk(paths, as_json, out):
+
+	rows = OrderedDict()
+
+	for path in dump_files(paths):
+		try:
+			row = decode(IntelHex(path).tobinstr())
+		except Exception as err:
+			row = OrderedDict((c, '') for c in columns)
+			row['error'] = str(err) or err.__class__.__name__
+		row['file'] = path
+		rows[path] = row
+
+	if as_json:
+		for row in rows.values():
+			del row['file']
+		json.dump(rows, out, indent=1)
+		out.write('\n')
+	else:
+		w = csv.writer(out)
+		w.writerow(columns)
+		for row in rows.values():
+			w.writerow(row.values())
+
+def usage():
+	print r'''Usage: dump_eeprom <dump
+       dump_eeprom [-c | -j] [-o <file>] <dump or dir>...
+		-c	CSV, one row per dump (default)
+		-j	JSON, an object per dump keyed by file name
+		-o <f>	Write to a file rather than stdout'''
+	sys.exit(1)
+
+try:
+	opts, args = getopt(sys.argv[1:], 'cjo:')
+except GetoptError as err:
+	print str(err)
+	usage()
+
+as_json = False
+outfile = None
+
+for o, a in opts:
+	if o == '-c':
+		as_json = False
+	elif o == '-j':
+		as_json = True
+	elif o == '-o':
+		outfile = a
+	else:
+		usage()
 
-print "SN: %s" % payload[4].strip('\000')
-print "WW: %d" % payload[5]
-print "YY: %d" % payload[6]
-print "Station: %s" % payload[7]
-print "Campaign: %s" % payload[8].strip('\000')
+if args:
+	out = sys.stdout
+	if outfile is not None:
+		out = open(outfile, 'wb')
+	bulk(args, as_json, out)
+	out.close()
+elif opts:
+	usage()
+else:
+	print_dump(IntelHex(source).tobinstr())
@@ -17,6 +17,25 @@
 #    ISO week & year of manufacture, production test fixture identifier and
 #    field for any associated campaign (e.g. pledge drive, promotion, etc)
 #
+# Above those is the channel save ring. Each time the user saves a channel
+# the firmware writes a copy of the running config (with a sequence number in
+# the last pad byte) into the next ring slot, and boots from the newest slot
+# with a good CRC. We always blank the ring here so that a freshly programmed
+# running config is not overridden by an old save still sitting in the ring.
+# The ring size depends on the part, so use -p if not programming an attiny45.
+#
+# With -B there is also a bandgap calibration just below the ring: the
+# ATtiny's internal 1.1V reference as measured on this unit, in mV. The
+# firmware measures the battery against it, so the low battery thresholds
+# are only as good as this number. Work it out at test from the supply
+# voltage and the unit's own reading of it, or leave it out and the
+# firmware uses the nominal 1100mV.
+#
+# On parts with more than 128 bytes of EEPROM there is also a station table
+# after the ring, filled in by the firmware the first time the user steps to
+# the next station. We blank it too so a unit reprogrammed for another area
+# scans again.
+#
 # Defaults to US settings unless otherwise specified.
 #
 # TODO: CLI parsing to set these.
@@ -32,7 +51,20 @@
 #  - Without the firmware:
 #       avrdude -qq -P usb -c avrisp2 -p attiny45 -B 15 -U eeprom:w:XYZ-1236.hex
 #    Note the absence of the "-e", or erase option in the second form.
-#  
+#
+# Batch mode makes the images for a whole production lot in one run, rather
+# than one run (and one mktemp, as in Maker.sh) per unit:
+#  - A range of serial numbers, with -S as a printf pattern for the number:
+#       eeprom.py -f 101.1 -M -S 'TPR-%05d' -R 1-500 -T A1 -C PLEDGE -o lot42
+#  - A CSV of units, with a header line naming the columns. sn is required,
+#    ts, campaign, freq, band, deemphasis, spacing, volume and bandgap are
+#    optional and default to the command line values:
+#       eeprom.py -f 101.1 -M -L units.csv -o lot42
+# With -o each unit gets <dir>/<sn>.hex, and <dir>/manifest.csv lists them.
+# Without -o the manifest goes to stdout instead, with each unit's whole
+# image as a hex string in the last column, for tools that program from
+# one file.
+#
 
 from intelhex import IntelHex
 from datetime import date
@@ -40,6 +72,9 @@ from struct import pack
 from math import modf
 from crcmod.predefined import Crc
 from getopt import getopt, GetoptError
+from binascii import hexlify
+import csv
+import os
 import sys
 
 #
@@ -65,19 +100,48 @@ demphasis=0		# US 75uS
 spacing=0		# US 200KHz
 volume=0x0f		# max (0 dBFS)
 
+# channel save ring, must match EEPROM_RING in firmware
+#
+ring_base=96
+ring_slots={'attiny25': 2, 'attiny45': 4, 'attiny85': 4}
+part='attiny45'
+
+# bandgap calibration, must match EEPROM_CALIBRATION and VCC_BANDGAP_MV_*
+# in firmware
 #
-# Create a manufacturing record.
+calibration_base=92
+bandgap=None
+bandgap_range=(950, 1250)
+
+# scanned station table, must match EEPROM_STATIONS in firmware
 #
+stations_base=160
+stations_size=31
+stations_parts=['attiny45', 'attiny85']
+
+# batch mode
+#
+serials=None
+unitlist=None
+outdir=None
+
+#
+# Create a manufacturing record. The week and year are taken once for the
+# run, so every unit in a lot gets the same date code.
+#
+today = date.today()
+ww = int(today.strftime('%V'))
+yy = int(today.strftime('%g'))
+
 def manuf_record(sn, ts, campaign):
-	ww = int(date.today().strftime('%V'))
-	yy = int(date.today().strftime('%g'))
 	return pack('17sBB2s13s17s', sn[:16], ww, yy, ts[:2], campaign[:12], eyecatcher)
 
-option_list='MS:T:C:f:b:d:s:v:'
+option_list='MS:T:C:f:b:d:s:v:p:B:R:L:o:'
 
 def usage():
-	print r'''Usage: eeprom -f <freq> [-b <n>] [-d <n>] [-s <n>] [-v <n>]
-		[-m [-S <sn>] [-T <ts>] [-C <campaign>]]
+	print r'''Usage: eeprom -f <freq> [-b <n>] [-d <n>] [-s <n>] [-v <n>] [-p <part>]
+		[-B <mV>] [-m [-S <sn>] [-T <ts>] [-C <campaign>]]
+		[-R <first>-<last> | -L <csv>] [-o <dir>]
 		-f <n>	Specify the frequency in MHz
 		-b <n>	Specify the band (0=87.5-108, 1=76-108, 2=76-90,
 			default = 0)
@@ -85,11 +149,19 @@ def usage():
 		-s <n>	Specify the channel spacing (0=200KHz, 1=100KHz,
 			2=50KHz, default = 0)
 		-v <n>	Specify max volume (0-15, default 15)
+		-p <p>	Specify the part (attiny25, attiny45, attiny85,
+			default = attiny45)
+		-B <mV>	Specify the measured bandgap voltage (950-1250)
 		-M	Append a manufacturing record (only to be used in
 			production test fixtures)
-		-S <sn>	Specify a serial number (<= 16 characters in length)
+		-S <sn>	Specify a serial number (<= 16 characters in length),
+			with -R a printf pattern for the number, e.g. TPR-%05d
 		-T <ts> Specify a test station identifier (<= 2 characters)
-		-C <c>	Specify a campaign (<= 12 characters in length)'''
+		-C <c>	Specify a campaign (<= 12 characters in length)
+		-R <r>	Batch: an image for each serial number in the range
+		-L <f>	Batch: an image for each unit in a CSV file
+		-o <d>	Batch: write <d>/<sn>.hex and <d>/manifest.csv, rather
+			than a manifest with the images in it to stdout'''
 	sys.exit(1)
 
 try:
@@ -117,14 +189,30 @@ for o, a in opts:
 		ts = a
 	elif o == '-C':
 		campaign = a
+	elif o == '-p':
+		part = a
+	elif o == '-B':
+		bandgap = int(a)
+	elif o == '-R':
+		try:
+			(first, last) = [int(n) for n in a.split('-')]
+		except ValueError:
+			print "Serial range must be <first>-<last>"
+			usage()
+		serials = range(first, last + 1)
+	elif o == '-L':
+		unitlist = a
+	elif o == '-o':
+		outdir = a
 	else:
 		usage()
 
-if band < 0 or band > 2 or demphasis < 0 or demphasis > 1 or spacing < 0 or spacing > 2 or volume < 0 or volume > 15:
+if part not in ring_slots:
+	print "Unknown part"
 	usage()
 
-if freq < 76.0 or freq > 108.0:
-	print "Frequency unspecified or out of bounds"
+if serials is not None and unitlist is not None:
+	print "Use either -R or -L, not both"
 	usage()
 
 #
@@ -135,38 +223,188 @@ if freq < 76.0 or freq > 108.0:
 base = {0: 87.5, 1: 76, 2: 76}
 step = {0: 5, 1: 10, 2: 20}
 
-try:
-	chan = round((freq - base[band]) * step[spacing], 4)
-except:
-	print "Illegal band and/or spacing"
-	sys.exit(1)
+class BadSettings(Exception):
+	def __init__(self, msg, status):
+		Exception.__init__(self, msg)
+		self.status = status
+
+def channel(freq, band, spacing):
+
+	if freq < 76.0 or freq > 108.0:
+		raise BadSettings("Frequency unspecified or out of bounds", 1)
+
+	try:
+		chan = round((freq - base[band]) * step[spacing], 4)
+	except:
+		raise BadSettings("Illegal band and/or spacing", 1)
 
-if modf(chan)[0] != 0.0:
-	print "Illegal freq/spacing combo"
-	sys.exit(2)
+	if modf(chan)[0] != 0.0:
+		raise BadSettings("Illegal freq/spacing combo", 2)
 
-chan = int(chan)
+	return int(chan)
 
 # First create the data without the checksum, note that we specify
-# little-endianness for multi-byte values.
+# little-endianness for multi-byte values. Then calculate and append
+# a crc-16 checksum. Units with the same settings share one block, so
+# a batch only works the CRC out once per distinct setting.
+
+tuning_blocks = {}
+
+def tuning_block(freq, band, demphasis, spacing, volume):
+
+	key = (freq, band, demphasis, spacing, volume)
+
+	if key not in tuning_blocks:
+
+		if band < 0 or band > 2 or demphasis < 0 or demphasis > 1 or spacing < 0 or spacing > 2 or volume < 0 or volume > 15:
+			raise BadSettings("Illegal band, demphasis, spacing or volume", 1)
+
+		chan = channel(freq, band, spacing)
+
+		t = pack('<BBBHB8x', band, demphasis, spacing, chan, volume)
+
+		crc16 = Crc('crc-16')
+		crc16.update(t)
+
+		tuning_blocks[key] = (t + pack('<H', crc16.crcValue), chan, crc16.crcValue)
+
+	return tuning_blocks[key]
+
+# The value, then its complement so the firmware can tell an erased or
+# half written record from a real one.
 
-t = pack('<BBBHB8x', band, demphasis, spacing, chan, volume)
+def calibration(bandgap):
 
-# Calculate and append a crc-16 checksum
-crc16 = Crc('crc-16')
-crc16.update(t)
+	if bandgap < bandgap_range[0] or bandgap > bandgap_range[1]:
+		raise BadSettings("Bandgap out of bounds", 1)
 
-t = t + pack('<H', crc16.crcValue)
+	return pack('<HH', bandgap, ~bandgap & 0xffff)
 
 #
 # Simply create a hex file with the concatenation of two tuning structures (t)
-# and optionally one manufacturing structure, then write the result.
+# and optionally one manufacturing structure and the calibration.
+# The ring is written separately as all 0xFF (erased) so the firmware
+# starts out running from the first tuning structure.
 #
-eeprom = t + t
+def image(t, record, cal):
+
+	eeprom = t + t
+
+	if record is not None:
+		eeprom = eeprom + record
+
+	hexfile = IntelHex()
+	hexfile.puts(0, eeprom)
+	if cal is not None:
+		hexfile.puts(calibration_base, cal)
+	hexfile.puts(ring_base, '\xff' * (16 * ring_slots[part]))
+	if part in stations_parts:
+		hexfile.puts(stations_base, '\xff' * stations_size)
+	return hexfile
+
+#
+# The units in a batch, each as a dict of whatever differs from the
+# command line values.
+#
+def batch_units():
+
+	if serials is not None:
+		pattern = sn
+		if '%' not in pattern:
+			pattern = pattern + '%d'
+		for n in serials:
+			yield {'sn': pattern % n}
+		return
+
+	with open(unitlist, 'rb') as f:
+		for row in csv.DictReader(f):
+			yield dict((k.strip(), v.strip()) for (k, v) in row.items() if k is not None and v)
+
+def batch():
+
+	defaults = {'ts': ts, 'campaign': campaign, 'freq': freq, 'band': band,
+		'deemphasis': demphasis, 'spacing': spacing, 'volume': volume, 'bandgap': bandgap}
+	numbers = {'freq': float, 'band': int, 'deemphasis': int, 'spacing': int, 'volume': int, 'bandgap': int}
+
+	if outdir is None:
+		out = sys.stdout
+	else:
+		if not os.path.isdir(outdir):
+			os.makedirs(outdir)
+		out = open(os.path.join(outdir, 'manifest.csv'), 'wb')
+
+	manifest = csv.writer(out)
+	manifest.writerow(['sn', 'ts', 'campaign', 'freq', 'channel', 'crc16', 'bandgap', 'image' if outdir is None else 'file'])
+
+	seen = set()
+
+	for unit in batch_units():
+
+		u = dict(defaults)
+		u.update(unit)
+
+		if not u.get('sn'):
+			print >> sys.stderr, "Unit %d has no serial number" % (len(seen) + 1)
+			sys.exit(1)
+
+		if u['sn'] in seen:
+			print >> sys.stderr, "%s: duplicate serial number" % u['sn']
+			sys.exit(1)
+		seen.add(u['sn'])
+
+		try:
+			for k in numbers:
+				if u[k] is not None:
+					u[k] = numbers[k](u[k])
+			(t, chan, crc) = tuning_block(u['freq'], u['band'], u['deemphasis'], u['spacing'], u['volume'])
+			cal = None
+			if u['bandgap'] is not None:
+				cal = calibration(u['bandgap'])
+		except ValueError:
+			print >> sys.stderr, "%s: bad number" % u['sn']
+			sys.exit(1)
+		except BadSettings as err:
+			print >> sys.stderr, "%s: %s" % (u['sn'], err)
+			sys.exit(err.status)
+
+		record = None
+		if manuf:
+			record = manuf_record(u['sn'], u['ts'], u['campaign'])
+
+		hexfile = image(t, record, cal)
+
+		if u['bandgap'] is None:
+			u['bandgap'] = ''
+
+		if outdir is None:
+			manifest.writerow([u['sn'], u['ts'], u['campaign'], u['freq'], chan, '%04X' % crc, u['bandgap'], hexlify(hexfile.tobinstr()).upper()])
+		else:
+			name = u['sn'] + '.hex'
+			with open(os.path.join(outdir, name), 'w') as f:
+				hexfile.write_hex_file(f)
+			manifest.writerow([u['sn'], u['ts'], u['campaign'], u['freq'], chan, '%04X' % crc, u['bandgap'], name])
+
+	if outdir is not None:
+		out.close()
+		print "%d images in %s" % (len(seen), outdir)
+
+if serials is not None or unitlist is not None:
+	batch()
+	sys.exit(0)
+
+try:
+	(t, chan, crc) = tuning_block(freq, band, demphasis, spacing, volume)
+	cal = None
+	if bandgap is not None:
+		cal = calibration(bandgap)
+except BadSettings as err:
+	print str(err)
+	if err.status == 1:
+		usage()
+	sys.exit(err.status)
 
+record = None
 if manuf:
-	eeprom = eeprom + manuf_record(sn, ts, campaign)
+	record = manuf_record(sn, ts, campaign)
 
-hexfile = IntelHex()
-hexfile.puts(0, eeprom)
-hexfile.write_hex_file(outfile)
+image(t, record, cal).write_hex_file(outfile)
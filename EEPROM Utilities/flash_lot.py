@@ -0,0 +1,294 @@
+#!/usr/bin/python
+
+#
+# Utility to program a production lot made by eeprom.py batch mode, on as
+# many ISP programmers as are plugged in, without anyone at the keyboard.
+#
+#	eeprom.py -f 101.1 -M -S 'TPR-%05d' -R 1-500 -T A1 -o lot42
+#	flash_lot.py -l lot42 -c avrisp2 -P usb:000200012345 -P usb:000200012346
+#
+# Each -P is one programmer (avrdude's -P, so usb:<serial>, usb:<bus>:<dev>
+# or a serial port), of the type given by the last -c before it. Every
+# programmer gets a worker of its own, taking the next serial number from
+# the lot's manifest.csv as soon as it has a unit to put it in, so a lot
+# goes through about as many times faster as there are programmers.
+#
+# A worker waits for a target to answer on its programmer, programs it,
+# then waits for it to go away before taking the next serial number, so
+# the operator only loads and unloads boards. With -N there is no waiting:
+# each programmer does the unit already on it and stops, for gang jigs
+# where every socket is loaded before the run.
+#
+# Flash is read back first, and only erased and written if it isn't the
+# firmware already (hash of both, ignoring the blank end of flash), which
+# is most of the time on a unit being reprogrammed for another area. Then
+# the unit's EEPROM image goes on. Without the erase the old EEPROM stays
+# under it, but eeprom.py images blank the ring and station table anyway.
+#
+# Each unit is tried -t times. One that still fails has its serial number
+# put back for the next unit, so the lot numbers run on without gaps, and
+# a programmer that fails 3 units in a row is taken out of the run.
+#
+# Every try goes into <lot>/results.csv (or -r), one row per serial number
+# and try, with avrdude's own output in <lot>/logs/<sn>.log. Serial numbers
+# with an ok row are skipped, so a stopped run carries on where it left off.
+#
+# NOTE: you will need the intelhex package, same as eeprom.py.
+#
+
+from intelhex import IntelHex
+from getopt import getopt, GetoptError
+from datetime import datetime
+from threading import Thread, Lock
+from Queue import Queue, Empty
+import subprocess
+import hashlib
+import tempfile
+import time
+import csv
+import os
+import sys
+
+avrdude = 'avrdude'
+
+lotdir = None
+firmware = 'pr.hex'
+part = 'attiny45'
+bitclock = None
+results = None
+programmers = []
+programmer = 'avrisp2'
+tries = 2
+wait = True
+
+poll_s = 1.0		# How often to look for a target coming or going
+strikes = 3		# Units in a row a programmer can fail before we stop using it
+
+option_list='l:F:p:B:c:P:r:t:N'
+
+def usage():
+	print r'''Usage: flash_lot -l <dir> [-F <hex>] [-p <part>] [-B <n>]
+		[-c <programmer>] -P <port> [[-c <programmer>] -P <port> ...]
+		[-r <csv>] [-t <n>] [-N]
+		-l <d>	The lot directory written by eeprom.py -o
+		-F <f>	Specify the firmware (default = pr.hex)
+		-p <p>	Specify the part (default = attiny45)
+		-B <n>	avrdude bit clock period, for slow targets
+		-c <c>	Programmer type for the -P options after it
+			(default = avrisp2)
+		-P <p>	A programmer, by avrdude port (usb:<serial>, ...)
+		-r <f>	Results log (default = <dir>/results.csv)
+		-t <n>	Tries per unit (default = 2)
+		-N	Don't wait for targets, program whatever is on each
+			programmer now and stop'''
+	sys.exit(1)
+
+try:
+	opts, args = getopt(sys.argv[1:], option_list)
+except GetoptError as err:
+	print str(err)
+	usage()
+
+for o, a in opts:
+	if o == '-l':
+		lotdir = a
+	elif o == '-F':
+		firmware = a
+	elif o == '-p':
+		part = a
+	elif o == '-B':
+		bitclock = a
+	elif o == '-c':
+		programmer = a
+	elif o == '-P':
+		programmers.append((programmer, a))
+	elif o == '-r':
+		results = a
+	elif o == '-t':
+		tries = int(a)
+	elif o == '-N':
+		wait = False
+	else:
+		usage()
+
+if lotdir is None or not programmers or args:
+	usage()
+
+if results is None:
+	results = os.path.join(lotdir, 'results.csv')
+
+logdir = os.path.join(lotdir, 'logs')
+
+#
+# What we compare flash with. Unused flash reads as 0xff, so both sides are
+# trimmed of that, and a longer old build doesn't compare equal to a
+# shorter new one.
+#
+def flash_hash(data):
+	return hashlib.sha1(data.rstrip('\xff')).hexdigest()
+
+firmware_hash = flash_hash(IntelHex(firmware).tobinstr(start=0))
+
+#
+# The lot, in manifest order, less anything that already went ok.
+#
+def lot_units():
+
+	done = set()
+	if os.path.exists(results):
+		with open(results, 'rb') as f:
+			for row in csv.DictReader(f):
+				if row['result'] == 'ok':
+					done.add(row['sn'])
+
+	with open(os.path.join(lotdir, 'manifest.csv'), 'rb') as f:
+		for row in csv.DictReader(f):
+			if 'file' not in row:
+				print "%s: no file column, make the lot with eeprom.py -o" % lotdir
+				sys.exit(1)
+			if row['sn'] not in done:
+				yield (row['sn'], os.path.join(lotdir, row['file']))
+
+log_lock = Lock()
+
+def say(port, msg):
+	with log_lock:
+		print "%s: %s" % (port, msg)
+		sys.stdout.flush()
+
+def log_result(sn, port, result, flash, seconds, detail):
+	with log_lock:
+		new = not os.path.exists(results)
+		with open(results, 'ab') as f:
+			w = csv.writer(f)
+			if new:
+				w.writerow(['time', 'sn', 'programmer', 'result', 'flash', 'seconds', 'detail'])
+			w.writerow([datetime.now().isoformat(' ')[:19], sn, port, result, flash, '%.1f' % seconds, detail])
+
+class AvrdudeFailed(Exception):
+	pass
+
+class Programmer:
+
+	def __init__(self, kind, port):
+		self.kind = kind
+		self.port = port
+		self.log = None
+
+	def run(self, *ops):
+		cmd = [avrdude, '-q', '-c', self.kind, '-P', self.port, '-p', part]
+		if bitclock is not None:
+			cmd += ['-B', bitclock]
+		cmd += list(ops)
+		p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+		out = p.communicate()[0]
+		if self.log is not None:
+			self.log.write('$ %s\n%s\n' % (' '.join(cmd), out))
+		if p.returncode != 0:
+			lines = [l for l in out.splitlines() if l.strip()]
+			raise AvrdudeFailed(lines[-1].strip() if lines else 'avrdude exit %d' % p.returncode)
+
+	# Just the signature read avrdude does on the way in, so ok when a target answers
+
+	def present(self):
+		try:
+			self.run()
+			return True
+		except AvrdudeFailed:
+			return False
+
+	def flash_matches(self):
+		(fd, path) = tempfile.mkstemp(suffix='.bin')
+		os.close(fd)
+		try:
+			self.run('-U', 'flash:r:%s:r' % path)
+			with open(path, 'rb') as f:
+				return flash_hash(f.read()) == firmware_hash
+		finally:
+			os.remove(path)
+
+	# Returns whether flash was written
+
+	def program(self, image):
+		if self.flash_matches():
+			self.run('-U', 'eeprom:w:%s:i' % image)
+			return False
+		self.run('-e', '-U', 'flash:w:%s:i' % firmware, '-U', 'eeprom:w:%s:i' % image)
+		return True
+
+def worker(prog, units):
+
+	failed = 0
+
+	while failed < strikes:
+
+		if wait:
+			while not prog.present():
+				if units.empty():
+					return
+				time.sleep(poll_s)
+
+		try:
+			(sn, image) = units.get_nowait()
+		except Empty:
+			return
+
+		ok = False
+		with open(os.path.join(logdir, sn + '.log'), 'a') as prog.log:
+			for n in range(tries):
+				start = time.time()
+				try:
+					flash = 'written' if prog.program(image) else 'skipped'
+					log_result(sn, prog.port, 'ok', flash, time.time() - start, '')
+					say(prog.port, "%s ok, flash %s" % (sn, flash))
+					ok = True
+					break
+				except AvrdudeFailed as err:
+					log_result(sn, prog.port, 'fail', '', time.time() - start, str(err))
+					say(prog.port, "%s try %d failed: %s" % (sn, n + 1, err))
+		prog.log = None
+
+		if ok:
+			failed = 0
+		else:
+			failed += 1
+			units.put((sn, image))
+
+		if not wait or units.empty():
+			return
+
+		while prog.present():
+			time.sleep(poll_s)
+
+	say(prog.port, "%d units in a row failed, not using this programmer" % strikes)
+
+units = Queue()
+for unit in lot_units():
+	units.put(unit)
+
+total = units.qsize()
+print "%d units to program on %d programmers" % (total, len(programmers))
+
+if not os.path.isdir(logdir):
+	os.makedirs(logdir)
+
+workers = []
+for (kind, port) in programmers:
+	t = Thread(target=worker, args=(Programmer(kind, port), units))
+	t.daemon = True
+	t.start()
+	workers.append(t)
+
+# Joined with a timeout, or Ctrl-C doesn't get through until they're done
+
+try:
+	while [t for t in workers if t.is_alive()]:
+		for t in workers:
+			t.join(0.5)
+except KeyboardInterrupt:
+	print "Stopped, run again to carry on"
+	sys.exit(1)
+
+left = units.qsize()
+print "%d of %d units programmed" % (total - left, total)
+sys.exit(0 if left == 0 else 1)
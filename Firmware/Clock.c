@@ -0,0 +1,70 @@
+/***
+
+System clock control, see Clock.h.
+
+Changing CLKPR takes a timed sequence (CLKPCE, then the new value within 4 cycles), so it is
+done with interrupts off, along with the timer prescaler changes so an ISR never sees the
+timers at the wrong rate.
+
+***/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "Clock.h"
+
+#define TIMER_CS_MASK       (0x0f)          // Timer1 CS13:CS10
+#define TIMER0_CS_MASK      (0x07)          // Timer0 CS02:CS00
+
+#define TIMER0_CK256        ( _BV(CS02) )
+#define TIMER0_CK1024       ( _BV(CS02) | _BV(CS00) )
+
+static uint8_t clock_div = CLOCK_DIV_FULL;
+
+void clock_set( uint8_t div ) {
+
+    if (div == clock_div) {
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+        CLKPR = _BV(CLKPCE);
+        CLKPR = div;
+
+        // Timer1 divides by 2^(CS-1), so each step of CLKPR is one step of CS the other way.
+        // Only touched while it is running (CS != 0). The LED engine uses CK/32 at F_CPU, so
+        // our range of clocks never pushes it off either end.
+
+        uint8_t cs = TCCR1 & TIMER_CS_MASK;
+
+        if (cs) {
+            TCCR1 = (TCCR1 & ~TIMER_CS_MASK) | (cs + clock_div - div);
+        }
+
+        // Timer0 can only follow the TWI speed up, and only from CK/256
+
+        cs = TCCR0B & TIMER0_CS_MASK;
+
+        if (div == CLOCK_DIV_TWI && cs == TIMER0_CK256) {
+            TCCR0B = (TCCR0B & ~TIMER0_CS_MASK) | TIMER0_CK1024;
+        } else if (clock_div == CLOCK_DIV_TWI && cs == TIMER0_CK1024) {
+            TCCR0B = (TCCR0B & ~TIMER0_CS_MASK) | TIMER0_CK256;
+        }
+    }
+
+    clock_div = div;
+}
+
+#ifdef CLOCK_CHECK
+
+void clock_check_full( void ) {
+
+    if (clock_div != CLOCK_DIV_FULL) {
+        cli();
+        for(;;);
+    }
+}
+
+#endif
@@ -0,0 +1,76 @@
+/***
+
+System clock control.
+
+The default fuses run us from the 8MHz internal RC oscillator with CKDIV8 set, so we come out of
+reset at 1MHz. That is F_CPU, and everything that depends on the clock is worked out from it:
+every _delay_*(), the ADC prescalers in VccADC.h, and the Timer0/Timer1 rates. The divider in
+CLKPR can be changed at run time, so a few places move the clock for a while:
+
+    CLOCK_DIV_TWI   4MHz for TWI transactions. The bit delays in USI_TWI_Master.c use
+                    clock_delay_us() with this divider, so they are right at this speed, and
+                    the burst is over (and we are back asleep) sooner. Note 4MHz is only in
+                    spec down to 1.8V on the ATtiny25V/45V/85V (0-4MHz at 1.8-5.5V). The plain
+                    ATtiny25/45/85 are specified from 2.7V, at any clock.
+
+    CLOCK_DIV_IDLE  125KHz while we idle sleep with the LED engine running. The CPU only wakes
+                    for the Timer1 ISR, which does not need the speed.
+
+    CLOCK_DIV_FULL  F_CPU. Anything that changes the clock must put it back to this before it
+                    returns, so the rest of the code never sees anything else. In particular
+                    no _delay_*() and no ADC use while the clock is moved. Build with
+                    -DCLOCK_CHECK to have those check it (see clock_check_full()).
+
+clock_set() keeps Timer1 counting at the same rate across a change by moving its prescaler the
+other way, so LED patterns do not speed up or slow down. Timer0 only has a few prescaler steps,
+so it is only kept right between CK/256 at F_CPU and CK/1024 at CLOCK_DIV_TWI, which is what the
+profiler uses.
+
+***/
+
+#include <avr/io.h>
+
+#define CLOCK_RC_HZ         (8000000UL)             // Internal RC oscillator, before CLKPR
+
+#define CLOCK_HZ(div)       ( CLOCK_RC_HZ >> (div) )
+
+#define CLOCK_DIV_TWI       (1)                     // 4MHz
+#define CLOCK_DIV_FULL      (3)                     // 1MHz, same as CKDIV8
+#define CLOCK_DIV_IDLE      (6)                     // 125KHz
+
+#define CLOCK_TWI_HZ        CLOCK_HZ( CLOCK_DIV_TWI )
+#define CLOCK_FULL_HZ       CLOCK_HZ( CLOCK_DIV_FULL )
+
+#ifndef F_CPU
+    #define F_CPU           CLOCK_FULL_HZ
+#endif
+
+#include <util/delay.h>
+
+// Spin for us microseconds of real time with the clock at CLOCK_HZ(div). _delay_us() counts
+// cycles at F_CPU, so the count is scaled up by how much faster the clock is running. Constant us only.
+
+#define clock_delay_us(us,div)  (_delay_us)( (us) * ((double) CLOCK_HZ( div ) / F_CPU) )
+
+// Debug builds only. Stops dead, interrupts off, if the clock is not at CLOCK_DIV_FULL, so a
+// debugger or the simulator shows who left it moved. Every _delay_*() checks it with -DCLOCK_CHECK,
+// and so does every ADC conversion in VccADC.c.
+
+#ifdef CLOCK_CHECK
+
+    void clock_check_full( void );
+
+    #define CLOCK_CHECK_FULL()  clock_check_full()
+
+    #define _delay_us(us)       ( clock_check_full() , (_delay_us)( us ) )
+    #define _delay_ms(ms)       ( clock_check_full() , (_delay_ms)( ms ) )
+
+#else
+
+    #define CLOCK_CHECK_FULL()
+
+#endif
+
+// Switch the system clock to CLOCK_HZ(div). Quick if the clock is already there. Safe with interrupts on.
+
+void clock_set( uint8_t div );
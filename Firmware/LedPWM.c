@@ -0,0 +1,139 @@
+/***
+
+LED engine for the indicator LED on PB4, using Timer1 PWM on OC1B.
+
+Everything after the initial setup happens in the Timer1 overflow ISR, which fires once per
+PWM cycle. The CPU is asleep in idle mode for the rest of the time.
+
+This code assumes default clock speed of 1MHz.
+
+***/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "LedPWM.h"
+
+#define LED_BLINK_ON_TICKS      (2)         // ~16ms
+#define LED_BLINK_SPACE_TICKS   (30)        // ~250ms between blinks in a group
+#define LED_BLINK_GAP_TICKS     (90)        // Brings the total up to about 1 sec per group
+
+#define LED_MODE_OFF            0
+#define LED_MODE_BREATHE        1
+#define LED_MODE_BLINK          2
+
+static volatile uint8_t led_mode;
+
+static uint8_t led_phase;       // Breathe: position in current breath. Blink: ticks left in current on or off 
+static uint8_t led_count;       // Breathe: breaths left (0=forever). Blink: blinks per group.
+static uint8_t led_blinks;      // Blink: blinks done so far in this group 
+static uint8_t led_duty;        // Peak brightness
+
+
+// Set the brightness right now. 0 disconnects OC1B so the LED is really off, not a tiny sliver of duty cycle.
+
+static void led_set( uint8_t duty ) {
+    
+    if (duty) {
+        OCR1B = duty;
+        GTCCR = _BV(PWM1B) | _BV(COM1B1);       // Clear OC1B on compare match, set when TCNT1=0
+    } else {
+        GTCCR = _BV(PWM1B);                     // OC1B disconnected, pin goes back to PORTB which is low
+    }
+}    
+
+static void led_start( uint8_t mode , uint8_t count , uint8_t duty ) {
+    
+    led_phase  = 0;
+    led_blinks = 0;
+    led_count  = count;
+    led_duty   = duty;
+    
+    PRR   &= ~_BV( PRTIM1 );            // Power up Timer1
+    
+    PORTB &= ~_BV( LED_PWM_BIT );      // Pin low so LED is off whenever OC1B is disconnected
+    
+    OCR1C = 255;                        // TOP
+    led_set( 0 );
+    TCNT1 = 0;
+    TCCR1 = _BV(CS12) | _BV(CS11);      // Timer1 clocked at CK/32, no PWM A
+    
+    TIFR  = _BV(TOV1);                  // Clear any old overflow
+    TIMSK |= _BV(TOIE1);
+    
+    led_mode = mode;
+}
+
+void led_pwm_off(void) {
+    
+    led_mode = LED_MODE_OFF;
+
+    TIMSK &= ~_BV(TOIE1);
+    
+    led_set( 0 );
+    TCCR1 = 0;                          // Stop the clock
+    GTCCR = 0;
+    
+    PORTB &= ~_BV( LED_PWM_BIT );       // In case someone turned it on directly
+    
+    PRR |= _BV( PRTIM1 );               // Power down Timer1
+}
+
+void led_pwm_breathe( uint8_t count , uint8_t duty ) {
+    led_start( LED_MODE_BREATHE , count , duty );
+}
+
+void led_pwm_blink( uint8_t count , uint8_t duty ) {
+    led_start( LED_MODE_BLINK , count , duty );
+}
+
+uint8_t led_pwm_running(void) {
+    return led_mode != LED_MODE_OFF;
+}
+
+
+ISR( TIMER1_OVF_vect ) {
+    
+    if (led_mode == LED_MODE_BREATHE) {
+        
+        // One breath is 256 ticks, about 2 secs. Ramp up then down, and square the ramp so it looks
+        // linear to the eye rather than spending most of the breath looking fully on.
+        
+        uint8_t ramp = (led_phase & 0x80) ? ~(led_phase << 1) : (led_phase << 1);
+        
+        uint8_t level = ( (uint16_t) ramp * ramp ) >> 8;
+        
+        led_set( ( (uint16_t) level * led_duty ) >> 8 );
+        
+        if (!++led_phase) {             // Finished a breath
+            
+            if (led_count && !--led_count) {
+                led_pwm_off();
+            }
+        }
+        
+    } else {    // LED_MODE_BLINK
+        
+        if (led_phase) {
+            
+            led_phase--;
+            
+        } else if ( GTCCR & _BV(COM1B1) ) {        // Was on, so turn off and wait
+            
+            led_set( 0 );
+            
+            if (++led_blinks < led_count) {
+                led_phase = LED_BLINK_SPACE_TICKS;
+            } else {
+                led_blinks = 0;
+                led_phase = LED_BLINK_GAP_TICKS;
+            }
+            
+        } else {                                    // Was off, so next blink
+            
+            led_set( led_duty );
+            led_phase = LED_BLINK_ON_TICKS;
+            
+        }
+    }
+}
@@ -0,0 +1,43 @@
+/***
+
+LED engine for the indicator LED on PB4, using Timer1 PWM on OC1B.
+
+Patterns are run entirely from the Timer1 overflow interrupt, so the CPU only has to
+start them and can then sleep. Note that Timer1 stops in power down, so while a pattern
+is running the caller must sleep in SLEEP_MODE_IDLE instead - see led_pwm_running().
+
+Timer1 is clocked at 1MHz/32 and counts to 255, so the PWM runs at ~122Hz and each
+pattern step (tick) is ~8.2ms. clock_set() keeps it at that rate when the system clock moves.
+
+This code assumes default clock speed of 1MHz.
+
+***/
+
+#include <avr/io.h>
+
+#define LED_PWM_BIT         PB4         // OC1B, so this is fixed by the hardware
+
+#define LED_PWM_FULL        (255)       // Duty for full brightness
+
+// Map an RSSI reading (dBuV, from register 0x0A) onto a breathing brightness so a strong
+// station breathes brighter than a weak one. Never totally dark so you can still see we are alive.
+
+#define LED_RSSI_DUTY(rssi) ( (rssi) >= 60 ? LED_PWM_FULL : ((rssi) << 2) + 15 )
+
+// Stop any pattern and turn the LED off. Powers down Timer1.
+
+void led_pwm_off(void);
+
+// Breathe the LED up and down at peak brightness duty, about 2 secs per breath.
+// Stops by itself after count breaths, or runs forever if count is 0.
+
+void led_pwm_breathe( uint8_t count , uint8_t duty );
+
+// Diagnostic blink - count quick (16ms) blinks 250ms apart, repeated about every second
+// until led_pwm_off() is called.
+
+void led_pwm_blink( uint8_t count , uint8_t duty );
+
+// Returns true while a pattern is running and Timer1 needs the clock
+
+uint8_t led_pwm_running(void);
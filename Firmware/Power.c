@@ -0,0 +1,74 @@
+/***
+
+Power states, see Power.h.
+
+This code assumes default clock speed of 1MHz.
+
+***/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "Clock.h"
+#include "Power.h"
+#include "VccADC.h"
+#include "LedPWM.h"
+#include "USI_TWI_Master.h"
+
+void power_init(void) {
+
+    PRR = _BV(PRTIM0) | _BV(PRTIM1) | _BV(PRUSI) | _BV(PRADC);
+
+    ACSR = _BV(ACD);                    // Analog comparator off
+
+    DIDR0 = POWER_DIDR0;
+}
+
+void power_sleep(void) {
+
+    if (led_pwm_running()) {
+
+        set_sleep_mode( SLEEP_MODE_IDLE );
+        clock_set( CLOCK_DIV_IDLE );
+        sleep_enable();
+        sleep_cpu();
+        clock_set( CLOCK_DIV_FULL );
+
+    } else {
+
+        set_sleep_mode( SLEEP_MODE_PWR_DOWN );
+        sleep_enable();
+        #ifdef sleep_bod_disable
+            sleep_bod_disable();        // Only lasts 3 cycles, so straight into the sleep
+        #endif
+        sleep_cpu();
+
+    }
+
+    sleep_disable();
+}
+
+void power_down(void) {
+
+    adc_off();
+
+    PRR |= _BV(PRTIM0) | _BV(PRUSI) | _BV(PRADC);
+}
+
+void power_up(void) {
+
+    #ifdef USI_TWI_HARDWARE
+        PRR &= ~_BV(PRUSI);
+    #endif
+}
+
+void power_off(void) {
+
+    led_pwm_off();
+
+    power_down();
+
+    cli();
+    power_sleep();
+}
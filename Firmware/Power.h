@@ -0,0 +1,48 @@
+/***
+
+Power states. Everything that sleeps or shuts down goes through here, so each sleep gets the
+lowest current setup that still keeps what is running running.
+
+Peripherals in PRR start out powered down by power_init(), and each module powers up its own
+while it needs it and back down after: adc_on()/adc_off() for the ADC, the LED engine for Timer1,
+the profiler for Timer0, and the USI engine (if built) for the USI. The bit-banged TWI engine does
+not need the USI at all.
+
+The digital input buffers are turned off on the pins we only ever drive (RESET to the FM_IC and
+the LED) and on PB5, and the analog comparator is turned off since nothing uses it. In power
+down the pins are clamped anyway, so this is for the time awake and in idle.
+
+Power down sleeps turn off the BOD for the length of the sleep (on parts that have BODS), so a
+unit built with the BOD fuses set still gets down to the WDT-only current. The BOD is back on
+before any code runs after waking.
+
+***/
+
+#include <avr/io.h>
+
+// Pins whose input buffers we never need. PB1 is RESET to the FM_IC and PB4 the LED, both outputs,
+// and PB5 is the RESET pin. PB0 (SDA), PB2 (SCL) and PB3 (button) are all read: both TWI engines
+// read SCL back to wait for it to go high. A pin in here reads as 0 in PINB, so the bench checks
+// that none of those three ever ends up in it.
+
+#define POWER_DIDR0     ( _BV(AIN1D) | _BV(ADC2D) | _BV(ADC0D) )
+
+// Call once at startup.
+
+void power_init(void);
+
+// Sleep until any interrupt. Power down if we can. If the LED engine is running a pattern Timer1
+// needs the clock, so idle with the clock turned down instead (see Clock.h).
+// Interrupts must be on, or this is forever.
+
+void power_sleep(void);
+
+// Low battery. Stop the ADC and power down everything but Timer1, which the LED engine still
+// needs for the warning blink. power_up() gets back what talking to the FM_IC needs.
+
+void power_down(void);
+void power_up(void);
+
+// Nothing left to do. LED off, everything powered down, and sleep with interrupts off, so forever.
+
+void power_off(void);
@@ -0,0 +1,133 @@
+/***
+
+Phase profiler, see Profile.h.
+
+Timer0 only counts to 255, so we keep the upper bits in profile_overflows. Most of the time
+interrupts are off while we are awake, so profile_now() also picks up an overflow that is still
+pending. Timer0 is stopped while we sleep, so the overflow interrupt only ever gets to run
+in the short window around sei().
+
+This code assumes default clock speed of 1MHz.
+
+***/
+
+#ifdef PROFILE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#include "Profile.h"
+
+#define PROFILE_TCCR0B      ( _BV(CS02) )                   // CK/256, see Clock.h
+
+typedef struct {
+    struct {
+        uint16_t count;
+        uint16_t ticks;
+    } phase[PROFILE_PHASES];
+    uint32_t awake_ticks;
+    uint32_t sleep_ticks;
+    uint16_t sleeps;
+    uint16_t boot_ms;
+} __attribute__((packed)) profile_record;
+
+static profile_record profile;
+
+static uint32_t profile_phase_start[PROFILE_PHASES];
+
+static uint32_t profile_boot_awake;         // Snapshots at profile_boot_begin()
+static uint32_t profile_boot_sleep;
+
+static volatile uint32_t profile_overflows;
+
+ISR( TIMER0_OVF_vect ) {
+    profile_overflows++;
+}
+
+// Timer0 ticks since profile_start(). Only call with interrupts off.
+
+static uint32_t profile_now(void) {
+
+    uint8_t t = TCNT0;
+
+    if (TIFR & _BV(TOV0)) {             // Overflowed and nobody has counted it yet
+        TIFR = _BV(TOV0);               // Clear by writing a 1
+        profile_overflows++;
+        t = TCNT0;                      // Could have been read before or after the overflow, so read again
+    }
+
+    return (profile_overflows << 8) | t;
+}
+
+void profile_start(void) {
+
+    PRR &= ~_BV( PRTIM0 );
+
+    TCCR0A = 0;                         // Normal mode
+    TCNT0  = 0;
+    TIFR   = _BV(TOV0);
+    TIMSK |= _BV(TOIE0);
+    TCCR0B = PROFILE_TCCR0B;
+
+}
+
+void profile_begin( profile_phase phase ) {
+
+    profile_phase_start[phase] = profile_now();
+
+}
+
+void profile_end( profile_phase phase ) {
+
+    uint32_t ticks = profile_now() - profile_phase_start[phase] + profile.phase[phase].ticks;
+
+    profile.phase[phase].ticks = ticks > 0xffff ? 0xffff : ticks;
+    profile.phase[phase].count++;
+
+}
+
+void profile_sleep_begin(void) {
+
+    profile.awake_ticks = profile_now();
+
+    TCCR0B = 0;                         // Stop Timer0 so it only counts awake time
+
+}
+
+void profile_sleep_end( uint16_t ticks ) {
+
+    TCCR0B = PROFILE_TCCR0B;
+
+    profile.sleep_ticks += ticks;
+    profile.sleeps++;
+
+}
+
+void profile_boot_begin(void) {
+
+    profile_boot_awake = profile_now();
+    profile_boot_sleep = profile.sleep_ticks;
+
+}
+
+void profile_boot_end(void) {
+
+    uint32_t awake = profile_now() - profile_boot_awake;
+    uint32_t slept = profile.sleep_ticks - profile_boot_sleep;
+
+    uint32_t ms = ((awake * 256) / 1000) + (slept * 16);
+
+    profile.boot_ms = ms > 0xffff ? 0xffff : ms;
+
+}
+
+void profile_save( void *dest ) {
+
+    profile.awake_ticks = profile_now();
+
+    eeprom_update_block( &profile , dest , sizeof( profile ) );
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+/***
+
+Phase profiler. Only built when PROFILE is defined (make PROFILE=1), otherwise the
+PROFILE_* macros below compile to nothing and this costs no flash or RAM.
+
+Timer0 is clocked at 1MHz/256, so one tick is 0.256ms. It only runs while the CPU is awake.
+clock_set() keeps it at that rate while TWI runs at 4MHz (see Clock.h), which it could not do from CK/1024.
+sleepFor() pauses it and reports the WDT time it slept instead, so a phase total is awake time
+and awake plus sleep is wall time. Sleeps that are cut short by a button press only count
+towards the sleep count, since there is no way to tell how long they were.
+
+The totals are kept in RAM and copied to EEPROM by profile_save() where a dump can get
+at them. The record is 32 bytes, and must match the layout in dump_eeprom.py:
+
+    5 x { uint16 count, uint16 awake ticks }    One per profile_phase, ticks saturate (at ~16s)
+    uint32  awake ticks                         Total Timer0 ticks since power up
+    uint32  sleep ticks                         Total WDT ticks (16ms) slept in sleepFor()
+    uint16  sleeps                              Number of sleepFor() calls
+    uint16  boot ms                             Wall time from leaving reset to audio on
+
+This code assumes default clock speed of 1MHz.
+
+***/
+
+#include <avr/io.h>
+
+typedef enum {
+    PROFILE_INIT,           // si4702_init()
+    PROFILE_ENABLE,         // si4702_enable()
+    PROFILE_TUNE,           // si4702_tune()
+    PROFILE_ADC,            // Battery checks
+    PROFILE_BUTTON,         // handleButtonDown()
+
+    PROFILE_PHASES          // Count, not a phase
+} profile_phase;
+
+#define PROFILE_RECORD_SIZE     (32)
+
+#ifdef PROFILE
+
+// Start Timer0 and clear the totals. Call once at startup.
+
+void profile_start(void);
+
+// Mark the start and end of a phase. Phases can nest, but a phase can not nest inside itself.
+
+void profile_begin( profile_phase phase );
+void profile_end( profile_phase phase );
+
+// Called by sleepFor() around the actual sleep. ticks is how many 16ms WDT ticks we slept, 0 if we woke early.
+
+void profile_sleep_begin(void);
+void profile_sleep_end( uint16_t ticks );
+
+// Mark the start and end of a boot, the end being when audio comes on.
+
+void profile_boot_begin(void);
+void profile_boot_end(void);
+
+// Copy the totals into the PROFILE_RECORD_SIZE bytes at EEPROM address dest. Only changed bytes are written.
+
+void profile_save( void *dest );
+
+#define PROFILE_START()             profile_start()
+#define PROFILE_BEGIN(phase)        profile_begin( phase )
+#define PROFILE_END(phase)          profile_end( phase )
+#define PROFILE_SLEEP_BEGIN()       profile_sleep_begin()
+#define PROFILE_SLEEP_END(ticks)    profile_sleep_end( ticks )
+#define PROFILE_BOOT_BEGIN()        profile_boot_begin()
+#define PROFILE_BOOT_END()          profile_boot_end()
+#define PROFILE_SAVE(dest)          profile_save( dest )
+
+#else
+
+#define PROFILE_START()
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(phase)
+#define PROFILE_SLEEP_BEGIN()
+#define PROFILE_SLEEP_END(ticks)
+#define PROFILE_BOOT_BEGIN()
+#define PROFILE_BOOT_END()
+#define PROFILE_SAVE(dest)
+
+#endif
@@ -0,0 +1,122 @@
+/***
+
+Field telemetry, see Telemetry.h.
+
+***/
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "Telemetry.h"
+
+#ifdef TELEMETRY
+
+typedef struct {
+    uint8_t  sequence;
+    uint16_t boots;
+    uint16_t seeks;
+    uint8_t  vcc;
+    uint8_t  low_battery;
+    uint8_t  crc_fails;
+    uint16_t crc16;
+} __attribute__((packed)) telemetry_record;
+
+#define TELEMETRY_CHECKED       ( sizeof( telemetry_record ) - sizeof( uint16_t ) )
+
+static telemetry_record telemetry;
+
+static uint8_t *telemetry_base;
+static uint8_t telemetry_slot;              // Where the next save goes
+static uint8_t telemetry_unsaved_seeks;
+
+// CRC-16 over the first len bytes of a record. Over all of it, a good one comes out 0.
+
+static uint16_t telemetry_crc( const telemetry_record *r , uint8_t len ) {
+
+    uint16_t crc = 0;
+
+    for( uint8_t i=0; i<len; i++ ) {
+        crc = _crc16_update( crc , ((const uint8_t *) r)[i] );
+    }
+
+    return crc;
+}
+
+void telemetry_load( const void *base ) {
+
+    telemetry_record r;
+    uint8_t found = 0;
+
+    telemetry_base = (uint8_t *) base;
+
+    for( uint8_t slot=0; slot<TELEMETRY_SLOTS; slot++ ) {
+
+        eeprom_read_block( &r , telemetry_base + (slot * TELEMETRY_RECORD_SIZE) , TELEMETRY_RECORD_SIZE );
+
+        // Good records are always within TELEMETRY_SLOTS of each other, so a signed difference handles the wrap
+
+        if (!telemetry_crc( &r , TELEMETRY_RECORD_SIZE ) && (!found || ((int8_t) (r.sequence - telemetry.sequence)) > 0)) {
+            telemetry = r;
+            telemetry_slot = slot + 1;
+            found = 1;
+        }
+    }
+
+    if (telemetry_slot >= TELEMETRY_SLOTS) {
+        telemetry_slot = 0;
+    }
+}
+
+static void saturating_inc( uint8_t *count ) {
+
+    if (*count != 0xff) {
+        (*count)++;
+    }
+}
+
+void telemetry_count( telemetry_event event ) {
+
+    switch (event) {
+
+        case TELEMETRY_BOOT:
+            telemetry.boots++;
+            break;
+
+        case TELEMETRY_SEEK:
+            telemetry.seeks++;
+            if (++telemetry_unsaved_seeks >= TELEMETRY_SEEK_BATCH) {
+                telemetry_save();
+            }
+            break;
+
+        case TELEMETRY_LOW_BATTERY:
+            saturating_inc( &telemetry.low_battery );
+            break;
+
+        case TELEMETRY_CRC_FAIL:
+            saturating_inc( &telemetry.crc_fails );
+            break;
+    }
+}
+
+void telemetry_vcc( uint16_t reading ) {
+
+    telemetry.vcc = reading >> TELEMETRY_VCC_SHIFT;
+}
+
+void telemetry_save(void) {
+
+    telemetry.sequence++;
+    telemetry.crc16 = telemetry_crc( &telemetry , TELEMETRY_CHECKED );
+
+    eeprom_update_block( &telemetry , telemetry_base + (telemetry_slot * TELEMETRY_RECORD_SIZE) , TELEMETRY_RECORD_SIZE );
+
+    if (++telemetry_slot >= TELEMETRY_SLOTS) {
+        telemetry_slot = 0;
+    }
+
+    telemetry_unsaved_seeks = 0;
+}
+
+#endif
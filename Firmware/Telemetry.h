@@ -0,0 +1,85 @@
+/***
+
+Field telemetry. A few lifetime counters, kept in RAM and written to a small ring in EEPROM, so a
+unit that comes back from the field can be dumped with avrdude and dump_eeprom.py shows what it
+has been through. Otherwise the TELEMETRY_* macros below compile to nothing.
+
+Each record is 10 bytes, and must match the layout in dump_eeprom.py:
+
+    uint8   sequence        One more than the record before, so the newest one wins
+    uint16  boots           Power ups. Wraps.
+    uint16  seeks           Short presses, each a seek or a step through the station table. Wraps.
+    uint8   vcc             Last readVcc() we took, divided by 32 (~1% steps). dump_eeprom.py turns it
+                            into volts with the bandgap calibration.
+    uint8   low battery     Low battery standbys the battery came back from. Saturates, and so does the
+                            next one. Nothing is saved while the battery is low (that is the brown out
+                            range), so a standby is only saved on the first good reading after it, and a
+                            shutdown is never saved at all.
+    uint8   crc fails       Channel saves in the parameter ring that were cut short, however that happened.
+                            Each is counted once: the boot that finds one blanks its CRC once Vcc has
+                            checked out good, so it reads as an erased slot after that, and that same
+                            boot saves the count. Blank slots do not count. Also counts each boot that
+                            found no good parameters anywhere, which is saved before the bad EEPROM blink.
+    uint16  crc16           CRC-16 of the 8 bytes before it, same as the parameter blocks
+
+Writes are batched. Counting only touches RAM, and a record goes out once per boot, when the
+battery comes back after a low battery standby, on a long press save (we are writing EEPROM then
+anyway), and after every TELEMETRY_SEEK_BATCH seeks. So a unit just turned off with the knob can lose the last few
+seeks, but nothing else. Each save goes to the next of TELEMETRY_SLOTS slots, the same way the
+parameter ring spreads its writes, and one cut short by a dying battery just leaves a bad CRC in
+that slot, so the record before it wins.
+
+Only built on parts with more than 128 bytes of EEPROM.
+
+***/
+
+#include <avr/io.h>
+
+#if E2END >= 0xff
+    #define TELEMETRY
+#endif
+
+#define TELEMETRY_RECORD_SIZE   (10)
+#define TELEMETRY_SLOTS         (3)
+#define TELEMETRY_SEEK_BATCH    (16)
+#define TELEMETRY_VCC_SHIFT     (5)         // readVcc() is never more than 8191 (Vcc above 1.1V), so this fits a byte
+
+typedef enum {
+    TELEMETRY_BOOT,
+    TELEMETRY_SEEK,
+    TELEMETRY_LOW_BATTERY,
+    TELEMETRY_CRC_FAIL,
+} telemetry_event;
+
+#ifdef TELEMETRY
+
+// Find the newest good record in the TELEMETRY_SLOTS records at EEPROM address base and carry on
+// from it, or from zero if there is none. Call once at startup, before anything is counted.
+
+void telemetry_load( const void *base );
+
+// Count one event. A TELEMETRY_SEEK that fills a batch also saves.
+
+void telemetry_count( telemetry_event event );
+
+// Remember the latest readVcc(). Only goes to EEPROM with the next save.
+
+void telemetry_vcc( uint16_t reading );
+
+// Write the counters out to the next slot. Only changed bytes are written.
+
+void telemetry_save(void);
+
+#define TELEMETRY_LOAD(base)        telemetry_load( base )
+#define TELEMETRY_COUNT(event)      telemetry_count( event )
+#define TELEMETRY_VCC(reading)      telemetry_vcc( reading )
+#define TELEMETRY_SAVE()            telemetry_save()
+
+#else
+
+#define TELEMETRY_LOAD(base)
+#define TELEMETRY_COUNT(event)
+#define TELEMETRY_VCC(reading)
+#define TELEMETRY_SAVE()
+
+#endif
@@ -27,20 +27,233 @@
 *
 ****************************************************************************/
 
-#define	F_CPU	1000000UL	/* Hack until we fix things the right way (tm) */
-
-
+// Everything in here runs with the clock at CLOCK_DIV_TWI (see Clock.h), since the public
+// functions switch to it on the way in and back on the way out. So every delay goes through
+// TWI_DELAY_US(), which works it out for that clock. Never a plain _delay_us() in here.
 
 #include <avr/io.h>
 #include "USI_TWI_Master.h"
-#include <util/delay.h>
+#include "Clock.h"
 
-#define BIT_TIME_US     (5)          // How long should should we wait between bit transitions?
+#define TWI_DELAY_US(us)    clock_delay_us( us , CLOCK_DIV_TWI )
 
 #define SBI(port,bit) (port|=_BV(bit))
 #define CBI(port,bit) (port&=~_BV(bit))
 #define TBI(port,bit) (port&_BV(bit))
 
+#ifdef TWI_MOCK_BUS
+
+#ifdef USI_TWI_HARDWARE
+    #error "The mock bus only models the bit-banged engine"
+#endif
+
+#include "bench/mockbus.h"
+
+#else
+
+static inline uint8_t scl_read(void) {
+    return TBI(PIN_USI , PIN_USI_SCL);
+}
+
+#endif
+
+// First thing that went wrong in the current transaction, as a USI_TWI_* code. 0 if nothing has.
+// Once set, the rest of the transaction is skipped and the public functions retry it.
+
+static uint8_t twi_error;
+
+static void twi_fail( uint8_t error ) {
+    if (!twi_error) {
+        twi_error = error;
+    }
+}
+
+// We have let go of SCL, so wait for it to really go high. The pull-up takes a while to get it
+// there, and a slave can hold it low to stretch the clock. Anything longer than TWI_SCL_POLLS
+// reads is not a stretch, so give up on the transaction.
+
+static void scl_wait_high(void) {
+
+    uint8_t polls = TWI_SCL_POLLS;
+
+    while (!scl_read()) {
+        if (!--polls) {
+            twi_fail( USI_TWI_SCL_STUCK );
+            return;
+        }
+    }
+}
+
+
+#ifdef USI_TWI_HARDWARE
+
+/*---------------------------------------------------------------
+ USI shift register engine (AVR310).
+
+ The USI shifts SDA out of (and into) USIDR on the SCL edges that
+ we generate by strobing USITC, so a whole byte costs one loop of
+ 16 clock toggles instead of dozens of individual pin writes and
+ delays. The 4-bit counter in USISR counts edges, so we preload it
+ to get an interrupt flag after either 8 bits or a single ACK bit.
+---------------------------------------------------------------*/
+
+// Clear all flags and count 16 edges (8 bits) before overflow
+#define USISR_8BIT  ( _BV(USISIF) | _BV(USIOIF) | _BV(USIPF) | _BV(USIDC) | (0x0<<USICNT0) )
+
+// Clear all flags and count 2 edges (1 bit) before overflow
+#define USISR_1BIT  ( _BV(USISIF) | _BV(USIOIF) | _BV(USIPF) | _BV(USIDC) | (0xE<<USICNT0) )
+
+/*---------------------------------------------------------------
+ Core function for shifting data in and out from the USI.
+ Data to be sent has to be placed into the USIDR prior to calling
+ this function. Data read, will be returned from the function.
+---------------------------------------------------------------*/
+
+static unsigned char USI_TWI_Master_Transfer( unsigned char temp )
+{
+  USISR = temp;                                     // Set USISR according to temp.
+                                                    // Prepare clocking.
+  temp  =  (0<<USISIE)|(0<<USIOIE)|                 // Interrupts disabled
+           (1<<USIWM1)|(0<<USIWM0)|                 // Set USI in Two-wire mode.
+           (1<<USICS1)|(0<<USICS0)|(1<<USICLK)|     // Software clock strobe as source.
+           (1<<USITC);                              // Toggle Clock Port.
+  do
+  {
+    TWI_DELAY_US( TWI_TLOW_US );
+    USICR = temp;                          // Generate positve SCL edge.
+    scl_wait_high();                       // Wait for SCL to go high.
+    TWI_DELAY_US( TWI_THIGH_US );
+    USICR = temp;                          // Generate negative SCL edge.
+  }while( !(USISR & (1<<USIOIF)) && !twi_error );   // Check for transfer complete.
+
+  TWI_DELAY_US( TWI_TLOW_US );
+  temp  = USIDR;                           // Read out data.
+  USIDR = 0xFF;                            // Release SDA.
+  DDR_USI |= (1<<PIN_USI_SDA);             // Enable SDA as output.
+
+  return temp;                             // Return the data from the USIDR
+}
+
+/*---------------------------------------------------------------
+ USI TWI single master initialization function
+---------------------------------------------------------------*/
+void USI_TWI_Master_Initialise( void )
+{
+  PRR &= ~_BV( PRUSI );                   // power_init() starts us powered down
+
+  // In two-wire mode a pin that is an output is only ever driven low, and is released
+  // when both the PORT bit and the USIDR MSB are 1. Set the PORT bits first so we
+  // never glitch the lines low on the way in.
+
+  PORT_USI |= (1<<PIN_USI_SDA);           // Release SDA.
+  PORT_USI |= (1<<PIN_USI_SCL);           // Release SCL.
+
+  DDR_USI  |= (1<<PIN_USI_SCL);           // Enable SCL as output.
+  DDR_USI  |= (1<<PIN_USI_SDA);           // Enable SDA as output.
+
+  USIDR    =  0xFF;                       // Preload dataregister with "released level" data.
+  USICR    =  (0<<USISIE)|(0<<USIOIE)|                            // Disable Interrupts.
+              (1<<USIWM1)|(0<<USIWM0)|                            // Set USI in Two-wire mode.
+              (1<<USICS1)|(0<<USICS0)|(1<<USICLK)|                // Software stobe as counter clock source
+              (0<<USITC);
+  USISR   =   USISR_8BIT;                                         // Clear flags, and reset counter.
+
+  // This leaves us with both SCL and SDA high, which is an idle state
+}
+
+
+// Write a byte out to the slave and look for ACK bit
+// Assumes SCL low, SDA doesn't matter
+
+// Returns 0=success, !0 if no ACK. SDA released, SCL low.
+
+static unsigned char USI_TWI_Write_Byte( unsigned char data ) {
+
+    USIDR = data;                           // Setup data
+    USI_TWI_Master_Transfer( USISR_8BIT );  // Send 8 bits on bus
+
+    // The device acknowledges by driving SDIO low for the 9th clock
+
+    DDR_USI &= ~(1<<PIN_USI_SDA);           // Enable SDA as input.
+
+    return USI_TWI_Master_Transfer( USISR_1BIT ) & _BV(TWI_NACK_BIT);
+
+}
+
+// Read a byte from the slave and send ACK bit, or NACK if this is the last byte we want
+// Assumes SCL low, returns with SCL low
+
+static unsigned char USI_TWI_Read_Byte( unsigned char last ) {
+
+    DDR_USI &= ~(1<<PIN_USI_SDA);           // Enable SDA as input.
+
+    unsigned char data = USI_TWI_Master_Transfer( USISR_8BIT );
+
+    //After each byte of data is read,
+    //the controller IC must drive an acknowledge (SDIO = 0)
+    //if an additional byte of data will be requested. Data
+    //transfer ends with the STOP condition.
+
+    USIDR = last ? 0xFF : 0x00;             // Load NACK (SDA released) or ACK
+    USI_TWI_Master_Transfer( USISR_1BIT );  // Generate (N)ACK
+
+    return(data);
+
+}
+
+
+// WriteFlag=0 leaves in read mode
+// WriteFlag=1 leaves in write mode
+// Returns 0 on success, !0 if no ACK bit received.
+// Assumes bus idle on entry (SCL and SDA high), or SDA released and SCL low for a repeated START
+// Returns with SCL low
+
+static unsigned char USI_TWI_Start( unsigned char addr , unsigned char readFlag) {
+
+    // Release SCL to ensure that (repeated) Start can be performed
+
+    PORT_USI |= (1<<PIN_USI_SCL);               // Release SCL.
+    scl_wait_high();                            // Verify that SCL becomes high.
+    TWI_DELAY_US( TWI_TLOW_US );
+
+    // Data transfer is always initiated by a Bus Master device. A high to low transition on the SDA line, while
+    // SCL is high, is defined to be a START condition or a repeated start condition.
+
+    PORT_USI &= ~(1<<PIN_USI_SDA);              // Force SDA LOW.
+    TWI_DELAY_US( TWI_THIGH_US );
+    PORT_USI &= ~(1<<PIN_USI_SCL);              // Pull SCL LOW.
+    PORT_USI |= (1<<PIN_USI_SDA);               // Release SDA. USIDR now controls the line.
+
+    // A START condition is always followed by the (unique) 7-bit slave address (MSB first) and then w/r bit
+
+    uint8_t controlword = (addr << 1) | readFlag;
+
+    return USI_TWI_Write_Byte( controlword );
+
+}
+
+
+// Data transfer ends with the STOP condition
+// (rising edge of SDIO while SCLK is high).
+// Assumes SCL low, exits with bus idle
+
+static void USI_TWI_Stop( void ) {
+
+    PORT_USI &= ~(1<<PIN_USI_SDA);           // Pull SDA low.
+    PORT_USI |= (1<<PIN_USI_SCL);            // Release SCL.
+    scl_wait_high();                         // Wait for SCL to go high.
+    TWI_DELAY_US( TWI_THIGH_US );
+    PORT_USI |= (1<<PIN_USI_SDA);            // Release SDA.
+    TWI_DELAY_US( TWI_TLOW_US );
+
+}
+
+#else   // Bit-banged engine
+
+// Everything below only touches the pins through these helpers and the two delays, so the
+// engine can be built for the host against a mock bus (see bench/twibench.c).
+
+#ifndef TWI_MOCK_BUS
 
 // These are open collector signals, so never drive high - only drive low or pull high
 
@@ -70,6 +283,26 @@ static inline uint8_t sda_read(void) {
     return TBI(PIN_USI , PIN_USI_SDA);
 }    
 
+// Wait out SCL low. Also the bus free time before a START and after a STOP.
+static inline void tlow_delay(void) {
+    TWI_DELAY_US( TWI_TLOW_US );
+}
+
+// Wait out SCL high. Also the setup and hold times around a START or STOP.
+static inline void thigh_delay(void) {
+    TWI_DELAY_US( TWI_THIGH_US );
+}
+
+#endif
+
+// Let SCL go and wait for it to get there, so the high time starts from when it is actually high
+// and not from when the slow pull-up started on it.
+
+static void scl_release(void) {
+    scl_pull_high();
+    scl_wait_high();
+}
+
 /*---------------------------------------------------------------
  USI TWI single master initialization function
 ---------------------------------------------------------------*/
@@ -86,13 +319,11 @@ void USI_TWI_Master_Initialise( void )
 // Write a byte out to the slave and look for ACK bit
 // Assumes SCL low, SDA doesn't matter
 
-// Returns 0=success, SDA high, SCL low. The ACK bit is still on SDA but will disapear on next SCL falling edge
+// Returns 0=success, !0 if no ACK. SDA high, SCL low.
 
 static unsigned char USI_TWI_Write_Byte( unsigned char data ) {
     
-    
-    
-    for( uint8_t bitMask=0b10000000; bitMask !=0; bitMask>>=1 ) {
+    for( uint8_t bitMask=0b10000000; bitMask !=0 && !twi_error; bitMask>>=1 ) {
         
         // setup data bit
                         
@@ -105,53 +336,47 @@ static unsigned char USI_TWI_Write_Byte( unsigned char data ) {
         
         // clock it out        
 
-        _delay_us(BIT_TIME_US);
+        tlow_delay();               // Also covers the time the pull-up needs to get a 1 up
                 
-        scl_pull_high();           // Clock in the next address bit
+        scl_release();              // Clock in the next bit
         
-        _delay_us(BIT_TIME_US);
+        thigh_delay();
         
         scl_drive_low();        
                         
     }        
             
-    // The device acknowledges the address by driving SDIO
-    // low after the next falling SCLK edge, for 1 cycle. 
+    // The device acknowledges by driving SDIO low for the 9th clock.
         
     sda_pull_high();            // Pull SDA high so we can see if the salve is driving low
-    _delay_us(BIT_TIME_US);     // Not needed, but so we can see what is happening on the scope
-    scl_pull_high();
-    _delay_us(BIT_TIME_US);     // TODO: Don't need all these delays
+    tlow_delay();
+    scl_release();
+    thigh_delay();
     
     uint8_t ret = sda_read();   // slave should be driving low now
     scl_drive_low();            // Slave release
-    _delay_us(BIT_TIME_US);     
-    
-    // TODO: CHeck ret
         
     return(ret);        
         
 }
 
-// Read a byte from the slave and send ACK bit
+// Read a byte from the slave and send ACK bit, or NACK if this is the last byte we want
 // Assumes SCL low, returns with SCL low
 // Assumed SDA pulled high
 
-// Returns 0=success, SDA high, SCL high
+// Returns the byte. SDA high, SCL low
 
-static unsigned char USI_TWI_Read_Byte(void) {
+static unsigned char USI_TWI_Read_Byte( unsigned char last ) {
           
     unsigned char data=0;
     
-    for( uint8_t bitMask=0b10000000; bitMask !=0; bitMask>>=1 ) {
-        
-        // Clock in the address bits
+    for( uint8_t bitMask=0b10000000; bitMask !=0 && !twi_error; bitMask>>=1 ) {
         
-        // TODO: Finish this
+        tlow_delay();               // Slave moves SDA while SCL is low
                                 
-        scl_pull_high();           // Clock in the next address bit
+        scl_release();              // Clock in the next bit
         
-        _delay_us(BIT_TIME_US);
+        thigh_delay();
         
         if (sda_read()) {
             
@@ -160,8 +385,6 @@ static unsigned char USI_TWI_Read_Byte(void) {
         }            
         
         scl_drive_low();
-        
-        _delay_us(BIT_TIME_US);
                                         
     }      
     
@@ -170,38 +393,43 @@ static unsigned char USI_TWI_Read_Byte(void) {
     //if an additional byte of data will be requested. Data
     //transfer ends with the STOP condition.         
 
-    sda_drive_low();            // Pull SDA high so we can see if the salve is driving low
-    _delay_us(BIT_TIME_US);     // Not needed, but so we can see what is happening on the scope       
-    scl_pull_high();            // Clock out the ACK bit    
-    _delay_us(BIT_TIME_US);
+    if (!last) {
+        sda_drive_low();        // Drive the ACK, a couple of instructions is plenty of setup time
+    }                           // Otherwise leave SDA pulled high for a NACK
+    tlow_delay();
+    scl_release();              // Clock out the (N)ACK bit    
+    thigh_delay();
     scl_drive_low();
     sda_pull_high();    
-    _delay_us(BIT_TIME_US);
     
     return(data);            
          
 }
 
 
-
 // WriteFlag=0 leaves in read mode
 // WriteFlag=1 leaves in write mode
 // Returns 0 on success, 1 if no ACK bit received.
-// Assumes bus idle on entry (SCL and SDA high) 
+// Assumes bus idle on entry (SCL and SDA high), or SDA high and SCL low for a repeated START
 // Returns with SCL low
 
 static unsigned char USI_TWI_Start( unsigned char addr , unsigned char readFlag) {
 
-    // We assume that we enter in idle state since that is how all public functions leave us
+    // We enter in idle state since that is how all public functions leave us, or for a repeated
+    // START with SCL low and SDA released after the last byte. Either way SCL has to be high.
+    
+    tlow_delay();        // Make sure we have been in idle at least long enough to see the falling SDA
+    
+    scl_release();
     
-    _delay_us(BIT_TIME_US);         // Make sure we have been in idle at least long enough to see the falling SDA
+    thigh_delay();
 
     // Data transfer is always initiated by a Bus Master device. A high to low transition on the SDA line, while
     // SCL is high, is defined to be a START condition or a repeated start condition.
        
     sda_drive_low();
     
-    _delay_us(BIT_TIME_US);
+    thigh_delay();
     
     scl_drive_low();
         
@@ -220,147 +448,140 @@ static unsigned char USI_TWI_Start( unsigned char addr , unsigned char readFlag)
 }    
 
 
-// Write the bytes pointed to by buffer
-// addr is the chip bus address
-// assumes bus is idle on entry, Exists with bus idle
-// Returns 0 on success
+// Data transfer ends with the STOP condition 
+// (rising edge of SDIO while SCLK is high). 
+// Assumes SCL low, exits with bus idle
 
-unsigned char USI_TWI_Write_Data(unsigned char addr, const uint8_t *buffer , uint8_t count)
+static void USI_TWI_Stop( void ) {
+    
+    sda_drive_low();
+    tlow_delay();
+    scl_release();
+    thigh_delay();
+    
+    sda_pull_high();
+    tlow_delay();
+    
+}
+
+#endif
+
+// Start a transaction and write the bytes pointed to by buffer. Works as a repeated START too.
+// Stops at the first byte the slave does not ACK.
+// Exits with SCL low, ready for a STOP or another START
+
+static void USI_TWI_Write_Bytes(unsigned char addr, const uint8_t *buffer , uint8_t count)
 {
-        
-    USI_TWI_Start( addr , 0 );      // TODO: check for error
     
+    if (USI_TWI_Start( addr , 0 )) {
+        twi_fail( USI_TWI_NO_ACK_ON_ADDRESS );
+    }
     
-    while (count--) {
+    while (count-- && !twi_error) {
         
-        USI_TWI_Write_Byte( *buffer );
+        if (USI_TWI_Write_Byte( *buffer )) {
+            twi_fail( USI_TWI_NO_ACK_ON_DATA );
+        }
         
         buffer++;
         
     }
     
-    // Data transfer ends with the STOP condition 
-    // (rising edge of SDIO while SCLK is high). 
-    
-    // TODO: Is this Really needed? Can we just do repeat starts and save this code? Spec is vague if address is reset on start. 
-    
-    sda_drive_low();
-    scl_pull_high();
-    _delay_us(BIT_TIME_US);
-    
-    sda_pull_high();
-    _delay_us(BIT_TIME_US);
-        
-    // End transaction with bus in idle
-    
-    return(0);
-    
 }
 
 
-// Fill data buffer with bytes read from TWI
-// addr is the chip bus address
-// assumes bus is idle on entry, Exists with bus idle
-// Returns 0 on success
+// Start a transaction and fill buffer with bytes read from the slave. Works as a repeated START too.
+// Every byte is ACKed except the last, which gets a NACK to tell the slave we are done
+// Exits with SCL low, ready for a STOP or another START
 
-unsigned char USI_TWI_Read_Data(unsigned char addr, uint8_t *buffer , uint8_t count)
+static void USI_TWI_Read_Bytes(unsigned char addr, uint8_t *buffer , uint8_t count)
 {
     
-    USI_TWI_Start( addr , 1 );      // TODO: check for error
+    if (USI_TWI_Start( addr , 1 )) {
+        twi_fail( USI_TWI_NO_ACK_ON_ADDRESS );
+    }
     
-    while (count--) {
+    while (count-- && !twi_error) {
         
-        *buffer = USI_TWI_Read_Byte();
+        *buffer = USI_TWI_Read_Byte( count == 0 );
         
         buffer++;
         
     }
     
-    // Data transfer ends with the STOP condition 
-    // (rising edge of SDIO while SCLK is high). 
+}
+
+
+// Write out_count bytes from out, then read in_count bytes into in after a repeated START, all in
+// one transaction. Either count can be 0 to skip that half. Saves the STOP, the bus idle time and
+// the clock switches of doing a separate write and read, and the slave has no chance to do
+// anything in between.
+//
+// If anything goes wrong (a NACK, or SCL stuck low) the transaction is ended with a STOP and run
+// again from the top, up to TWI_TRIES times. The STOP and the next START also unstick a slave that
+// lost count of the clocks in a glitch, since it lets go of SDA by the time it sees our next address.
+// That is all safe to repeat, since every write to the FM_IC starts over at 0x02 and every read at 0x0A.
+//
+// assumes bus is idle on entry, Exists with bus idle
+// Returns 0 on success, or the USI_TWI_* code for what went wrong on the last try. On a failed read
+// the contents of in are garbage.
+
+unsigned char USI_TWI_Write_Read_Data(unsigned char addr, const uint8_t *out , uint8_t out_count , uint8_t *in , uint8_t in_count)
+{
     
-    // TODO: Is this Really needed? Can we just do repeat starts and save this code? Spec is vague if address is reset on start. 
-    // TODO: Make stop function to save space
+    uint8_t tries = TWI_TRIES;
     
-    sda_drive_low();
-    scl_pull_high();
-    _delay_us(BIT_TIME_US);
+    clock_set( CLOCK_DIV_TWI );
     
-    sda_pull_high();
-    _delay_us(BIT_TIME_US);
+    do {
+        
+        twi_error = 0;
+        
+        if (out_count) {
+            USI_TWI_Write_Bytes( addr , out , out_count );
+        }
+        
+        if (in_count && !twi_error) {
+            USI_TWI_Read_Bytes( addr , in , in_count );
+        }
         
+        // Data transfer ends with the STOP condition 
+        // (rising edge of SDIO while SCLK is high). 
+        
+        USI_TWI_Stop();
+        
+    } while (twi_error && --tries);
+    
     // End transaction with bus in idle
     
-    return(0);
+    clock_set( CLOCK_DIV_FULL );
+    
+    return(twi_error);
     
 }
 
-// TODO: delete this placeholder
-
-/*
-unsigned char USI_TWI_Start_Transceiver_With_Data(unsigned char c, unsigned char *d, unsigned char l) {
-    return(0);
-} 
-*/   
 
-/*---------------------------------------------------------------
- Core function for shifting data in and out from the USI.
- Data to be sent has to be placed into the USIDR prior to calling
- this function. Data read, will be returned from the function.
----------------------------------------------------------------*/
+// Write the bytes pointed to by buffer
+// addr is the chip bus address
+// assumes bus is idle on entry, Exists with bus idle
+// Returns 0 on success, a USI_TWI_* code otherwise
 
-/*
-unsigned char USI_TWI_Master_Transfer( unsigned char temp )
+unsigned char USI_TWI_Write_Data(unsigned char addr, const uint8_t *buffer , uint8_t count)
 {
-  USISR = temp;                                     // Set USISR according to temp.
-                                                    // Prepare clocking.
-  temp  =  (0<<USISIE)|(0<<USIOIE)|                 // Interrupts disabled
-           (1<<USIWM1)|(0<<USIWM0)|                 // Set USI in Two-wire mode.
-           (1<<USICS1)|(0<<USICS0)|(1<<USICLK)|     // Software clock strobe as source.
-           (1<<USITC);                              // Toggle Clock Port.
-  do
-  {
-    _delay_us( T2_TWI/4 );              
-    USICR = temp;                          // Generate positve SCL edge.
-    while( !(PIN_USI & (1<<PIN_USI_SCL)) );// Wait for SCL to go high.
-    _delay_us( T4_TWI/4 );              
-    USICR = temp;                          // Generate negative SCL edge.
-  }while( !(USISR & (1<<USIOIF)) );        // Check for transfer complete.
-  
-  _delay_us( T2_TWI/4 );                
-  temp  = USIDR;                           // Read out data.
-  USIDR = 0xFF;                            // Release SDA.
-  DDR_USI |= (1<<PIN_USI_SDA);             // Enable SDA as output.
-
-  return temp;                             // Return the data from the USIDR
+    
+    return USI_TWI_Write_Read_Data( addr , buffer , count , 0 , 0 );
+    
 }
 
 
-*/
-
-/*---------------------------------------------------------------
- Function for generating a TWI Stop Condition. Used to release 
- the TWI bus.
----------------------------------------------------------------*/
+// Fill data buffer with bytes read from TWI
+// addr is the chip bus address
+// assumes bus is idle on entry, Exists with bus idle
+// Returns 0 on success, a USI_TWI_* code otherwise
 
-/*
-unsigned char USI_TWI_Master_Stop( void )
+unsigned char USI_TWI_Read_Data(unsigned char addr, uint8_t *buffer , uint8_t count)
 {
-  PORT_USI &= ~(1<<PIN_USI_SDA);           // Pull SDA low.
-  PORT_USI |= (1<<PIN_USI_SCL);            // Release SCL.
-  while( !(PIN_USI & (1<<PIN_USI_SCL)) );  // Wait for SCL to go high.
-  _delay_us( T4_TWI/4 );               
-  PORT_USI |= (1<<PIN_USI_SDA);            // Release SDA.
-  _delay_us( T2_TWI/4 );                
-  
-#ifdef SIGNAL_VERIFY
-  if( !(USISR & (1<<USIPF)) )
-  {
-    USI_TWI_state.errorState = USI_TWI_MISSING_STOP_CON;    
-    return (FALSE);
-  }
-#endif
-
-  return (TRUE);
+    
+    return USI_TWI_Write_Read_Data( addr , 0 , 0 , buffer , count );
+    
 }
-*/
\ No newline at end of file
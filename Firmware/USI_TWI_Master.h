@@ -29,20 +29,36 @@
     #include<avr/io.h> 
 //********** Defines **********//
 
-// Defines controlling timing limits
-#define TWI_FAST_MODE
+// Defines controlling which engine drives the bus.
+// USI_TWI_HARDWARE uses the USI shift register and clock strobe to move each byte, which is
+// much quicker than the bit-banged engine. Note that two-wire mode overrides the internal
+// pin pull-ups, so this needs external pull-ups on SDA and SCL. Current TPR boards rely on
+// the internal pull-ups, so leave this off unless your board has the resistors fitted.
+//#define USI_TWI_HARDWARE
 
-#define SYS_CLK   1000.0  // [kHz]
+// Defines controlling timing limits. Both engines hold SCL low for at least TWI_TLOW_US and
+// high for at least TWI_THIGH_US, and use the same times for the setup and hold around START and
+// STOP. The pin writes come on top, and each high time only starts once SCL has actually got there
+// (see TWI_SCL_POLLS), so the clock always runs a little under the limit. The Si4702 is good for
+// fast mode.
+#define TWI_FAST_MODE
 
 #ifdef TWI_FAST_MODE               // TWI FAST mode timing limits. SCL = 100-400kHz
-  #define T2_TWI    ((SYS_CLK *1300) /1000000) +1 // >1,3us
-  #define T4_TWI    ((SYS_CLK * 600) /1000000) +1 // >0,6us
+  #define TWI_TLOW_US   (1.3)   // >1,3us
+  #define TWI_THIGH_US  (0.6)   // >0,6us
   
 #else                              // TWI STANDARD mode timing limits. SCL <= 100kHz
-  #define T2_TWI    ((SYS_CLK *4700) /1000000) +1 // >4,7us
-  #define T4_TWI    ((SYS_CLK *4000) /1000000) +1 // >4,0us
+  #define TWI_TLOW_US   (4.7)   // >4,7us
+  #define TWI_THIGH_US  (4.0)   // >4,0us
 #endif
 
+// A released SCL that has not gone high after this many reads (~250us at 4MHz) is stuck, not
+// rising slowly through the pull-up or being stretched by the slave.
+#define TWI_SCL_POLLS   (200)
+
+// Goes on each transaction that fails before we give up and return the error
+#define TWI_TRIES       (3)
+
 // Defines controling code generating
 //#define PARAM_VERIFICATION
 //#define NOISE_TESTING
@@ -67,6 +83,7 @@
 #define USI_TWI_NO_ACK_ON_ADDRESS   0x06  // The slave did not acknowledge  the address
 #define USI_TWI_MISSING_START_CON   0x07  // Generated Start Condition not detected on bus
 #define USI_TWI_MISSING_STOP_CON    0x08  // Generated Stop Condition not detected on bus
+#define USI_TWI_SCL_STUCK           0x09  // Released SCL never went high
 
 // Device dependant defines
 
@@ -118,4 +135,5 @@ unsigned char USI_TWI_Get_State_Info( void );
 
 unsigned char USI_TWI_Read_Data(unsigned char addr, unsigned char *msg, unsigned char msgSize);
 
-unsigned char USI_TWI_Write_Data(unsigned char addr, const uint8_t *data , uint8_t size); 
+unsigned char USI_TWI_Write_Data(unsigned char addr, const uint8_t *data , uint8_t size);
+unsigned char USI_TWI_Write_Read_Data(unsigned char addr, const uint8_t *out , uint8_t out_count , uint8_t *in , uint8_t in_count); 
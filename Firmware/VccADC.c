@@ -7,7 +7,8 @@ These functions use the internal bandgap to measure the Vcc voltage
 
 This code is processor specific so may not work on other chips besides ATTINY25/45/85.
 
-This code assumes default clock speed of 1MHz.
+The ADC prescalers are worked out from F_CPU (see VccADC.h), so the ADC must only be used with
+the clock there (see Clock.h).
 
 More info here...
 https://wp.josh.com/2014/11/06/battery-fuel-guage-with-zero-parts-and-zero-pins-on-avr/
@@ -16,15 +17,59 @@ https://wp.josh.com/2014/11/06/battery-fuel-guage-with-zero-parts-and-zero-pins-
 ***/
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
 
-#define F_CPU 1000000
+#include "Clock.h"
+#include "VccADC.h"
 
-#include <util/delay.h>
+// First conversion after enable takes 25 ADC clocks (200us), then 13 clocks (104us) each.
+// This many throwaway conversions covers the 1ms bandgap settling time.
+
+#define ADC_SETTLE_CONVERSIONS  (9)
+
+// Samples taken since the last adc_freerun_next(). Otherwise the ISR only needs to exist to wake us from ADC Noise Reduction sleep.
+
+static volatile uint8_t adc_freerun_count;
+
+ISR( ADC_vect ) {
+    adc_freerun_count++;
+}
+
+
+// Do one conversion with the CPU asleep in ADC Noise Reduction mode.
+// The digital clocks are stopped while we sleep, so the reading is quieter too.
+// Entering this sleep mode would start a conversion anyway, but we start it explicitly so that ADSC
+// is guaranteed to read as one until it is done.
+// Any other interrupt (button, WDT) will wake us early, so go back to sleep until the conversion is done.
+// Assumes interrupts are off on entry, and leaves them off.
+
+static void adc_sleep_conversion(void) {
+    
+    CLOCK_CHECK_FULL();
+    
+    ADCSRA |= _BV(ADIE) | _BV(ADSC);    // Start a conversion. Conversion complete interrupt will wake us
+    
+    set_sleep_mode( SLEEP_MODE_ADC );
+    sleep_enable();
+    sei();    
+    
+    do {
+        sleep_cpu();
+    } while ( ADCSRA & _BV( ADSC ) );   // Woke for something else? Still converting.
+    
+    cli();
+    sleep_disable();
+    
+    ADCSRA &= ~_BV(ADIE);
+}
 
 // Enables ADC and sets to read the internal 1.1V bandgap voltage against Vcc scale
 
 void adc_on(void) {
     
+    PRR &= ~_BV( PRADC );           // Power up the ADC, adc_off() powers it down again
+    
     // Select ADC inputs
     // bit    76543210 
     // REFS = 00       = Vcc used as Vref
@@ -38,8 +83,8 @@ void adc_on(void) {
     kHz and 200 kHz to get maximum resolution.
     */  
                 
-    // Enable ADC, set prescaller to /8 which will give a ADC clock of 1mHz/8 = 125kHz    
-    ADCSRA = _BV(ADEN) | _BV(ADPS1) | _BV(ADPS0);
+    // Enable ADC, set prescaller to ADC_ADPS which will give a ADC clock of ADC_CLOCK_HZ (1mHz/8 = 125kHz)    
+    ADCSRA = _BV(ADEN) | (ADC_ADPS << ADPS0);
 
     // Enable ADC, set prescaller to /2 which will give a ADC clock of 128khz/2 = 64kHz    
     //ADCSRA = _BV(ADEN);
@@ -50,18 +95,17 @@ void adc_on(void) {
         measurements are stable. Conversions starting before this may not be reliable. The ADC must
         be enabled during the settling time.
     */
-        
-    _delay_ms(1);
                 
     /*
         The first conversion after switching voltage source may be inaccurate, and the user is advised to discard this result.
     */
     
-    ADCSRA |= _BV(ADSC);                // Start a conversion
-
-
-    while( ADCSRA & _BV( ADSC) ) ;      // Wait for 1st conversion to be ready...
-                                        //..and ignore the result        
+    // Rather than spin for 1ms, sleep though enough throwaway conversions to cover it.
+    // This also takes care of discarding the 1st conversion.
+    
+    for( uint8_t c=ADC_SETTLE_CONVERSIONS; c; c-- ) {
+        adc_sleep_conversion();         // ..and ignore the result
+    }        
     
 }
 
@@ -75,6 +119,8 @@ void adc_on(void) {
 void adc_off(void) {
     
    ADCSRA &= ~_BV( ADEN );         // Disable ADC to save power
+   
+   PRR |= _BV( PRADC );            // Only after ADEN is clear
     
 }        
 
@@ -82,10 +128,7 @@ void adc_off(void) {
 uint16_t readADC(void) {
     
         
-    ADCSRA |= _BV(ADSC);                // Start a conversion
-
-
-    while( ADCSRA & _BV( ADSC) ) ;      // Wait for conversion to be ready...
+    adc_sleep_conversion();             // Sleep until conversion is ready...
         
     /*
         After the conversion is complete (ADIF is high), the conversion result can be found in the ADC
@@ -102,3 +145,67 @@ uint16_t readADC(void) {
     return adc;
                     
 }
+
+
+uint16_t readVcc(void) {
+    
+    uint16_t sum = 0;
+    
+    for( uint8_t i=VCC_OVERSAMPLE; i; i-- ) {
+        sum += readADC();               // 8 x 1023 still fits
+    }
+    
+    return sum;
+}
+
+
+uint16_t vcc_threshold( uint16_t bandgap_mv , uint16_t vcc_mv ) {
+    
+    return ( (uint32_t) bandgap_mv * (1023UL * VCC_OVERSAMPLE) ) / vcc_mv;
+    
+}
+
+
+// Switch an ADC that is already on (see adc_on()) to free running. Prescaler goes to ADC_FREERUN_ADPS,
+// /16 which is 62.5KHz at 1MHz, so with 13 clocks per conversion a new sample lands every ADC_FREERUN_US.
+// Left adjusted so ADCH alone is the top 8 bits. adc_on() puts everything back the way it was.
+
+void adc_freerun_on(void) {
+    
+    ADMUX |= _BV(ADLAR);
+    
+    ADCSRB = 0;                         // ADTS = 000, free running
+    
+    adc_freerun_count = 0;
+    
+    CLOCK_CHECK_FULL();
+    
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | (ADC_FREERUN_ADPS << ADPS0);
+    
+}
+
+// Sleep in idle until the next free running sample (noise reduction mode would restart the conversion).
+// Returns how many samples have landed since the last call, normally 1, and puts the newest in *sample.
+// Counting them means time stays right even if the caller was too slow to catch every one.
+// Must be called with interrupts off, and leaves them off.
+
+uint8_t adc_freerun_next( uint8_t *sample ) {
+    
+    set_sleep_mode( SLEEP_MODE_IDLE );
+    sleep_enable();
+    sei();
+    
+    while (!adc_freerun_count) {
+        sleep_cpu();
+    }
+    
+    cli();
+    sleep_disable();
+    
+    uint8_t n = adc_freerun_count;
+    adc_freerun_count = 0;
+    
+    *sample = ADCH;
+    
+    return n;
+}
@@ -19,21 +19,44 @@ https://wp.josh.com/2014/11/06/battery-fuel-guage-with-zero-parts-and-zero-pins-
     #error F_CPU must be definded before this header
 #endif
 
-#if F_CPU!=1000000
-    #error You must edit the ADC prescaler to match F_CPU if it is not 1000000!
-#endif
-
 #include <avr/io.h>
 #include <util/delay.h>
 
+// ADC prescaler (ADPS) for conversions, worked out from F_CPU. The ADC wants a 50-200KHz clock
+// for full resolution, so take the smallest division that gets under 200KHz. /8 at 1MHz.
+// Only right with the clock at F_CPU, which is the only clock the ADC is ever used at (see Clock.h).
+
+#if   F_CPU <= 400000UL
+    #define ADC_ADPS    (1)
+#elif F_CPU <= 800000UL
+    #define ADC_ADPS    (2)
+#elif F_CPU <= 1600000UL
+    #define ADC_ADPS    (3)
+#elif F_CPU <= 3200000UL
+    #define ADC_ADPS    (4)
+#elif F_CPU <= 6400000UL
+    #define ADC_ADPS    (5)
+#elif F_CPU <= 12800000UL
+    #define ADC_ADPS    (6)
+#else
+    #error F_CPU too fast for the ADC, free running needs a prescaler step to spare
+#endif
+
+#define ADC_CLOCK_HZ    ( F_CPU >> ADC_ADPS )
+
+// Free running (see adc_freerun_on()) goes one division slower, /16 at 1MHz.
+
+#define ADC_FREERUN_ADPS    ( ADC_ADPS + 1 )
+
 // Enables ADC and sets to read the internal 1.1V bandgap voltage against Vcc scale
 
 void adc_on(void);
 void adc_off(void);
 
 
-// ADC clock at 1mhz with /8 prescaller is 125Khz
-// Takes ~125us 
+// ADC clock is ADC_CLOCK_HZ, 125Khz at 1mhz
+// Takes ~125us, which we spend asleep in ADC Noise Reduction mode.
+// Must be called with interrupts off. The ADC interrupt is only enabled while we sleep. 
 
 #define ADC_DELAY_US 125 
 
@@ -60,3 +83,40 @@ uint16_t readADC(void);
 // when V is const, which it should be. 
 
 #define VCC_LESS_THAN(v) (readADC()>VCC2ADC(v))      // returns true if the Measured Vcc is than V
+
+// The macros above assume the bandgap is exactly 1.1V, but it can be anywhere from 1.0V to 1.2V
+// from part to part, which moves every threshold by the same 10%. The battery checks use these
+// instead, with the bandgap measured for each unit at production test (see main.c).
+
+// Sum of VCC_OVERSAMPLE conversions, so 3 more bits than readADC() and a spike from the amp only
+// counts for an eighth. Like readADC(), bigger is lower Vcc. Takes ~1ms. ADC must be on.
+
+#define VCC_OVERSAMPLE      (8)
+
+uint16_t readVcc(void);
+
+#define VCC_BANDGAP_MV      (1100)      // Nominal, used when a unit has no calibration
+#define VCC_BANDGAP_MV_MIN  (950)       // Anything outside these is a bad calibration, not a bad part
+#define VCC_BANDGAP_MV_MAX  (1250)
+
+#define VCC_MV(v)           ((uint16_t) ((v) * 1000.0 + 0.5))       // Volts to mV, for constant v
+
+// What readVcc() reads at vcc_mv on a part whose bandgap is bandgap_mv. Integer only, so work
+// out thresholds once and compare raw readings against them. It works the other way round too:
+// vcc_threshold( bandgap_mv , readVcc() ) is Vcc in mV.
+
+uint16_t vcc_threshold( uint16_t bandgap_mv , uint16_t vcc_mv );
+
+// Free running mode for the programming receiver, see VccProg.c. Call adc_on() first.
+
+void adc_freerun_on(void);
+
+#define ADC_FREERUN_US  ( (13UL << ADC_FREERUN_ADPS) * 1000000UL / F_CPU )     // 13 clocks per conversion, 208us at 1MHz
+
+// Sleeps until the next sample, returns how many samples since the last call. Must be called with interrupts off.
+
+uint8_t adc_freerun_next( uint8_t *sample );
+
+// Same as VCC2ADC() but for the 8 bit left adjusted samples adc_freerun_next() returns
+
+#define VCC2ADCH(v) ((uint8_t) ((1.1*1023.0)/(v)/4))
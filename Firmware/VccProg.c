@@ -0,0 +1,251 @@
+/***
+
+One-touch jig receiver, see VccProg.h for the protocol.
+
+Everything runs in the main thread between samples. adc_freerun_next() sleeps us until the next
+sample and says how many have gone by, so our sense of time is just a count of samples. The per
+sample work is a compare or two, and decoding only happens on a falling edge, which is at least
+VCCPROG_DENSE_MIN samples apart. So we should never be slow enough to miss one, and even if we
+are the counts keep the timing right.
+
+This code assumes default clock speed of 1MHz.
+
+***/
+
+#include <avr/io.h>
+#include <util/crc16.h>
+
+#include "Clock.h"
+#include "VccADC.h"
+#include "VccProg.h"
+
+#ifdef VCCPROG
+
+#define SAMPLES(us)             ( (us) / ADC_FREERUN_US )
+
+#define VCCPROG_GAP             SAMPLES( VCCPROG_GAP_US )
+#define VCCPROG_LISTEN          ((uint16_t) ((VCCPROG_LISTEN_S * 1000000UL) / ADC_FREERUN_US))
+
+// Each dense interval n owns the window centred on BASE + n*STEP, so jitter up to half a step still decodes
+
+#define VCCPROG_DENSE_MIN       SAMPLES( VCCPROG_DENSE_BASE_US - (VCCPROG_DENSE_STEP_US / 2) )
+#define VCCPROG_DENSE_STEP      SAMPLES( VCCPROG_DENSE_STEP_US )
+#define VCCPROG_DENSE_MAX       ( VCCPROG_DENSE_MIN + (4 * VCCPROG_DENSE_STEP) - 1 )
+
+// Legacy windows. The short one starts just past the longest dense interval, which is how we tell the frames apart.
+
+#define VCCPROG_LEGACY_MIN      ( VCCPROG_DENSE_MAX + 1 )
+#define VCCPROG_LEGACY_MAX      SAMPLES( VCCPROG_LEGACY_BIT_US + (VCCPROG_LEGACY_BIT_US / 4) )
+#define VCCPROG_LEGACY_0_MIN    SAMPLES( (2 * VCCPROG_LEGACY_BIT_US) - (VCCPROG_LEGACY_BIT_US / 4) )
+#define VCCPROG_LEGACY_0_MAX    SAMPLES( (2 * VCCPROG_LEGACY_BIT_US) + (VCCPROG_LEGACY_BIT_US / 2) )
+
+#define VCCPROG_ACK             SAMPLES( VCCPROG_ACK_US )
+#define VCCPROG_NAK             SAMPLES( VCCPROG_NAK_US )
+#define VCCPROG_ANSWER_GAP      SAMPLES( VCCPROG_ANSWER_GAP_US )
+
+#if VCCPROG_LEGACY_0_MAX >= VCCPROG_GAP
+    #error "Legacy 0 bit would look like the end of a frame"
+#endif
+
+typedef enum {
+    FRAME_IDLE,             // Waiting for the first dip
+    FRAME_START,            // Seen the first dip, next interval tells us which kind
+    FRAME_LEGACY,
+    FRAME_DENSE,
+    FRAME_BAD,              // Something did not fit, ignore the rest until the gap
+} frame_mode;
+
+static uint8_t *frame;
+static frame_mode mode;
+static uint8_t bits;        // Bits received so far
+static uint8_t sync;        // Legacy: the last dip was a sync, so the next is data or the next sync
+
+static void put_bits( uint8_t value , uint8_t count ) {
+
+    while (count--) {
+
+        if (bits >= VCCPROG_PARAMS_LEN * 8) {
+            mode = FRAME_BAD;
+            return;
+        }
+
+        if (value & _BV(count)) {
+            frame[ bits >> 3 ] |= 0x80 >> (bits & 7);
+        }
+
+        bits++;
+    }
+}
+
+// A falling edge, interval samples after the one before
+
+static void edge( uint16_t interval ) {
+
+    if (interval >= VCCPROG_GAP) {
+
+        mode = FRAME_START;
+        bits = 0;
+
+        for( uint8_t i=0; i<VCCPROG_PARAMS_LEN; i++ ) {
+            frame[i] = 0;
+        }
+
+        return;
+    }
+
+    if (mode == FRAME_START) {
+
+        if (interval <= VCCPROG_DENSE_MAX) {
+            mode = FRAME_DENSE;
+        } else {
+            mode = FRAME_LEGACY;
+            sync = 1;               // The start dip was the first sync
+        }
+    }
+
+    if (mode == FRAME_DENSE) {
+
+        if (interval < VCCPROG_DENSE_MIN || interval > VCCPROG_DENSE_MAX) {
+            mode = FRAME_BAD;
+        } else {
+            put_bits( (interval - VCCPROG_DENSE_MIN) / VCCPROG_DENSE_STEP , 2 );
+        }
+
+    } else if (mode == FRAME_LEGACY) {
+
+        if (interval >= VCCPROG_LEGACY_MIN && interval <= VCCPROG_LEGACY_MAX) {
+
+            if (sync) {
+                put_bits( 1 , 1 );  // Data dip after a sync
+            }
+
+            sync = !sync;           // After a data dip comes a sync
+
+        } else if (sync && interval >= VCCPROG_LEGACY_0_MIN && interval <= VCCPROG_LEGACY_0_MAX) {
+
+            put_bits( 0 , 1 );      // No data dip, so this is already the next sync
+
+        } else {
+
+            mode = FRAME_BAD;
+        }
+    }
+}
+
+// Quiet for a whole gap, so whatever we were receiving is over. Returns the frame length if it is good.
+
+static uint8_t frame_end(void) {
+
+    uint8_t len = 0;
+
+    if (mode == FRAME_LEGACY && sync) {
+        put_bits( 0 , 1 );          // A 0 as the last bit has no dip after its sync
+    }
+
+    if (mode == FRAME_LEGACY && bits == (VCCPROG_CHANNEL_LEN + 2) * 8) {
+
+        uint16_t crc = _crc16_update( _crc16_update( 0 , frame[0] ) , frame[1] );
+
+        if ( (crc >> 8) == frame[2] && (crc & 0xff) == frame[3] ) {
+            len = VCCPROG_CHANNEL_LEN;
+        }
+
+    } else if (mode == FRAME_DENSE && bits == VCCPROG_PARAMS_LEN * 8) {
+
+        uint16_t crc = 0;
+
+        for( uint8_t i=0; i<VCCPROG_PARAMS_LEN; i++ ) {
+            crc = _crc16_update( crc , frame[i] );
+        }
+
+        if (!crc) {                 // CRC over a block including its own CRC comes out 0
+            len = VCCPROG_PARAMS_LEN;
+        }
+    }
+
+    mode = FRAME_IDLE;
+
+    return len;
+}
+
+// Let samples go by. The ADC is still free running, so they are our clock here too.
+
+static void wait_samples( uint16_t samples ) {
+
+    uint8_t sample;
+
+    while (samples) {
+
+        uint8_t n = adc_freerun_next( &sample );
+
+        samples = n < samples ? samples - n : 0;
+    }
+}
+
+void vccprog_answer( uint8_t ack ) {
+
+    PORTB |= _BV( VCCPROG_LOAD_BIT );
+
+    wait_samples( ack ? VCCPROG_ACK : VCCPROG_NAK );
+
+    PORTB &= ~_BV( VCCPROG_LOAD_BIT );
+
+    wait_samples( VCCPROG_ANSWER_GAP );
+}
+
+uint8_t vccprog_receive( uint8_t *buffer ) {
+
+    uint16_t since = VCCPROG_GAP;       // Samples since the last falling edge, stops counting at VCCPROG_GAP
+    uint16_t quiet = 0;                 // Same, but keeps counting, for the listen timeout
+    uint8_t low = 0;
+
+    frame = buffer;
+    mode = FRAME_IDLE;
+
+    adc_freerun_on();
+
+    while (quiet < VCCPROG_LISTEN) {
+
+        uint8_t sample;
+        uint8_t n = adc_freerun_next( &sample );
+
+        quiet += n;
+
+        if (since < VCCPROG_GAP) {
+            since += n;
+        }
+
+        if (low) {
+
+            if (sample <= VCCPROG_RISE_ADCH) {          // Bigger samples are lower Vcc
+                low = 0;
+            }
+
+        } else if (sample >= VCCPROG_DIP_ADCH) {
+
+            low = 1;
+            edge( since );
+            since = 0;
+            quiet = 0;
+
+        } else if (since >= VCCPROG_GAP && mode != FRAME_IDLE) {
+
+            uint8_t heard = (mode != FRAME_START);      // A lone dip is just noise, not a frame to NAK
+
+            uint8_t len = frame_end();
+
+            if (len) {
+                return len;
+            }
+
+            if (heard) {
+                vccprog_answer( 0 );
+                quiet = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+#endif
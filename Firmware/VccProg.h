@@ -0,0 +1,91 @@
+/***
+
+Receiver for the one-touch programming jig (One-touch_Programming_Jig.ino).
+
+The jig powers the TPR from its own pins at 5V, which batteries can never reach, so seeing 5V at
+boot means we are on the jig. It talks to us by pulling Vcc down in short dips. Only the falling
+edges are sharp (the 10uF cap makes the recovery slow and variable), so all the information is in
+the time between one falling edge and the next. We watch Vcc with free running bandgap
+samples, one every ADC_FREERUN_US, and time the edges in samples.
+
+Frames are separated by at least VCCPROG_GAP_US with no dips. There are two kinds of frame, and
+the interval between the first two dips tells them apart:
+
+  Channel frame (the original protocol)
+
+    Each bit is a sync dip, followed 10ms later by a data dip for a 1. The next sync comes 10ms
+    after the data dip, or 20ms after the sync for a 0. That is 20ms per bit. 4 bytes, MSB first:
+    channel high, channel low, then the CRC-16 of those two bytes, high byte first.
+
+  Parameter frame
+
+    A start dip, then 64 dips that each carry 2 bits in how long after the previous dip they come:
+    VCCPROG_DENSE_BASE_US + n * VCCPROG_DENSE_STEP_US for n = 0-3. Bits go MSB first. The 16 bytes
+    are a whole parameter block exactly as it sits in EEPROM, CRC included, so ~0.4s a unit.
+    Short dips (~0.5ms) are enough for these since we only need to see the edge.
+
+After each frame we answer by loading Vcc with the LED, which the jig sees as a droop on the pins
+it powers us from:
+
+  ACK   Load on for VCCPROG_ACK_US. The frame was good and reads back good from EEPROM. We boot
+        with it once the answer is done, so the jig should not send this unit anything more.
+
+  NAK   Load on for VCCPROG_NAK_US. We heard a frame but it did not decode or the CRC was bad
+        (or a channel frame came with no good factory block to go with it). We keep listening,
+        so the jig can send it again.
+
+Each answer starts at least VCCPROG_GAP_US after the last dip of the frame, and is followed by
+VCCPROG_ANSWER_GAP_US with the load off before we do anything else, so the jig sees it end before
+the rest of the boot starts drawing current. A unit that missed the frame completely says nothing.
+
+All the timings are measured at the jig end, and must match it.
+
+Only built on parts with more than 2K of flash. Production units are ATTiny45.
+
+This code assumes default clock speed of 1MHz.
+
+***/
+
+#include <avr/io.h>
+
+#if FLASHEND > 0x7ff
+    #define VCCPROG
+#endif
+
+#define VCCPROG_VOLTAGE         (4.5)       // At or above this at boot, we are on the jig
+
+#define VCCPROG_DIP_ADCH        VCC2ADCH( 4.0 )     // Vcc below 4.0V is a dip...
+#define VCCPROG_RISE_ADCH       VCC2ADCH( 4.4 )     // ...and we need to see it back above 4.4V before the next one
+
+#define VCCPROG_GAP_US          (40000UL)   // Quiet this long ends a frame. Jig waits 50ms.
+#define VCCPROG_LISTEN_S        (10)        // Quiet this long and we give up and boot normally
+
+#define VCCPROG_LEGACY_BIT_US   (10000UL)   // Sync to data, and data to next sync
+#define VCCPROG_DENSE_BASE_US   (4000UL)
+#define VCCPROG_DENSE_STEP_US   (1250UL)
+
+#define VCCPROG_ACK_US          (40000UL)
+#define VCCPROG_NAK_US          (10000UL)
+#define VCCPROG_ANSWER_GAP_US   (20000UL)
+
+#define VCCPROG_LOAD_BIT        PB4         // The LED. Must already be an output.
+
+#define VCCPROG_CHANNEL_LEN     (2)
+#define VCCPROG_PARAMS_LEN      (16)        // Must be sizeof(param_block)
+
+#ifdef VCCPROG
+
+// Listen for one good frame. buffer must have room for VCCPROG_PARAMS_LEN bytes.
+// Returns VCCPROG_CHANNEL_LEN with the channel in buffer high byte first, VCCPROG_PARAMS_LEN with the block
+// in buffer, or 0 if nothing good came in VCCPROG_LISTEN_S. Frames with a bad CRC are NAKed and we keep listening.
+// ADC must be on (adc_on()), and is left in free running mode, so call adc_on() or adc_off() after.
+// Must be called with interrupts off.
+
+uint8_t vccprog_receive( uint8_t *buffer );
+
+// Answer the frame vccprog_receive() just returned, ACK if ack is true and NAK otherwise.
+// ADC must still be free running from vccprog_receive(). Must be called with interrupts off.
+
+void vccprog_answer( uint8_t ack );
+
+#endif
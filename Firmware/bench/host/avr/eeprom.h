@@ -0,0 +1,56 @@
+/***
+
+Host stand-in for <avr/eeprom.h>. EEPROM addresses in the firmware are small integers cast to
+pointers, so here they index host_eeprom[], which is defined in twibench.c.
+
+***/
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+
+extern uint8_t host_eeprom[E2END + 1];
+extern uint32_t host_eeprom_writes;            // Bytes that actually changed
+
+#define HOST_EE(p)      (host_eeprom[ (uintptr_t)(p) ])
+
+static inline uint8_t eeprom_read_byte( const uint8_t *p ) {
+    return HOST_EE(p);
+}
+
+static inline uint16_t eeprom_read_word( const uint16_t *p ) {
+    return HOST_EE(p) | (HOST_EE( (const uint8_t *)p + 1 ) << 8);
+}
+
+static inline void eeprom_read_block( void *dst , const void *src , size_t n ) {
+    for( size_t i=0; i<n; i++ ) {
+        ((uint8_t *)dst)[i] = HOST_EE( (const uint8_t *)src + i );
+    }
+}
+
+static inline void eeprom_update_byte( uint8_t *p , uint8_t value ) {
+    if (HOST_EE(p) != value) {
+        HOST_EE(p) = value;
+        host_eeprom_writes++;
+    }
+}
+
+static inline void eeprom_update_word( uint16_t *p , uint16_t value ) {
+    eeprom_update_byte( (uint8_t *)p , value & 0xff );
+    eeprom_update_byte( (uint8_t *)p + 1 , value >> 8 );
+}
+
+static inline void eeprom_update_block( const void *src , void *dst , size_t n ) {
+    for( size_t i=0; i<n; i++ ) {
+        eeprom_update_byte( (uint8_t *)dst + i , ((const uint8_t *)src)[i] );
+    }
+}
+
+#define eeprom_write_byte   eeprom_update_byte
+#define eeprom_write_word   eeprom_update_word
+#define eeprom_write_block  eeprom_update_block
+
+#endif
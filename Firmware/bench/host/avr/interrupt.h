@@ -0,0 +1,21 @@
+/***
+
+Host stand-in for <avr/interrupt.h>. An ISR is just a function the bench can call.
+
+***/
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector, ...)    void vector(void)
+
+#define WDT_vect            host_wdt_vect
+#define PCINT0_vect         host_pcint0_vect
+
+void WDT_vect(void);
+void PCINT0_vect(void);
+
+#define sei()
+#define cli()
+
+#endif
@@ -0,0 +1,54 @@
+/***
+
+Host stand-in for <avr/io.h>, just enough to build main.c and USI_TWI_Master.c for bench/twibench.c.
+The I/O registers are plain variables defined in twibench.c, and only the bits the firmware
+names are here. Pass -DE2END to pick the EEPROM size of the part, it defaults to an ATTiny25.
+
+***/
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit)    (1 << (bit))
+
+#ifndef E2END
+    #define E2END   (0x7f)
+#endif
+
+extern volatile uint8_t PORTB, DDRB, PINB;
+extern volatile uint8_t PRR, GIMSK, PCMSK, WDTCR, MCUCR, SREG;
+
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+
+#define PCINT3  3
+#define PCIE    5
+
+#define WDP0    0
+#define WDP1    1
+#define WDP2    2
+#define WDE     3
+#define WDCE    4
+#define WDP3    5
+#define WDIE    6
+#define WDIF    7
+
+#define AIN0D   0
+#define AIN1D   1
+#define ADC1D   2
+#define ADC3D   3
+#define ADC2D   4
+#define ADC0D   5
+
+#define PRADC   0
+#define PRUSI   1
+#define PRTIM0  2
+#define PRTIM1  3
+
+#endif
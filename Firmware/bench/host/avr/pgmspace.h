@@ -0,0 +1,16 @@
+/***
+
+Host stand-in for <avr/pgmspace.h>. There is only one address space here.
+
+***/
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+
+#endif
@@ -0,0 +1,12 @@
+/***
+
+Host stand-in for <avr/wdt.h>
+
+***/
+
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#define wdt_reset()
+
+#endif
@@ -0,0 +1,14 @@
+/***
+
+Host stand-in for <util/atomic.h>. Nothing on the host interrupts us.
+
+***/
+
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type)  for( int _atomic_once = 1; _atomic_once; _atomic_once = 0 )
+
+#endif
@@ -0,0 +1,17 @@
+/***
+
+Host stand-in for <util/delay.h>. Delays cost no real time, they just move the bench clock on.
+
+***/
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+void host_delay_us( double us );
+
+// Functions rather than macros, same as avr-libc, so Clock.h can wrap them for CLOCK_CHECK
+
+static inline void _delay_us( double us ) { host_delay_us( us ); }
+static inline void _delay_ms( double ms ) { host_delay_us( ms * 1000.0 ); }
+
+#endif
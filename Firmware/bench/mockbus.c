@@ -0,0 +1,449 @@
+/***
+
+Mock TWI bus and stub Si4702, see mockbus.h.
+
+The slave side follows the same rules a real slave does: it samples SDA on rising SCL, only ever
+changes SDA while SCL is low, and treats an SDA edge while SCL is high as START or STOP. So an
+engine change that breaks the protocol shows up here as garbage registers or missing ACKs rather
+than passing quietly.
+
+The stub only models what the firmware uses. Writes go in at 0x02 and reads come out from 0x0A,
+both wrapping at 0x0f. TUNE and SEEK complete after the datasheet worst case (60ms per channel
+stepped), but never before the chip has had the 110ms powerup time since ENABLE.
+
+Clearing SEEK or TUNE takes STC_CLEAR_US to show up in STC, and setting either while STC is still
+up is ignored, which is what the datasheet's "STC must be set low before the next seek or tune may
+begin" does on a real chip. The real time is not in the datasheet. The firmware got by on a 1ms
+wait for years, so this is shorter than that but long enough that a status read right behind the
+clear still sees STC up, so the restart has to poll for it.
+
+***/
+
+#include <stdio.h>
+#include "mockbus.h"
+#include "../USI_TWI_Master.h"          // Same bus timing as the engine
+
+#define SI4702_ADDRESS      (0x10)
+
+#define POWERUP_US          (110000UL)
+#define TUNE_US             (60000UL)
+#define SEEK_US_PER_CHAN    (60000UL)
+#define STC_CLEAR_US        (250UL)
+
+#define RSSI_STATION        (40)
+#define RSSI_NOISE          (8)
+
+mockbus_stats mockbus;
+double host_us;
+uint16_t si4702_regs[16];
+
+// Master side of the lines. Open collector, so all the master can do is pull low or let go.
+
+static uint8_t m_sda_low, m_scl_low;
+static uint8_t s_sda_low;               // Slave pulling SDA low
+
+static uint8_t line_sda = 1, line_scl = 1;
+static uint8_t busy;                    // Between START and STOP
+
+typedef enum { S_IDLE, S_ADDR, S_WRITE, S_READ, S_IGNORE } slave_state;
+
+static slave_state state, next_state;
+static uint8_t clock;                   // SCL rising edges seen in the current byte, 9th is the (N)ACK
+static uint8_t shift;
+static uint8_t acking;                  // Slave will drive the 9th bit low
+static uint8_t nacked;                  // Master NACKed the byte we just sent
+
+static uint8_t reg_ptr;                 // Register the next byte goes to or comes from
+static uint8_t lo_byte;                 // Next byte is the low half of reg_ptr
+static uint8_t hi_hold;
+
+// Seek and tune in progress
+
+static uint8_t  op_pending;
+static double   op_done_at;
+static uint16_t op_chan;
+static uint8_t  op_fail;
+static double   ready_at;
+static uint8_t  powered;
+static uint8_t  stc_clearing;
+static double   stc_clear_at;
+
+static uint8_t  glitches;               // Address bytes left to ignore, see mockbus_glitch()
+
+static const uint16_t *stations;
+static uint8_t station_count;
+
+void mockbus_stats_reset(void) {
+    mockbus = (mockbus_stats){0};
+}
+
+void host_delay_us( double us ) {
+    host_us += us;
+}
+
+void si4702_stub_stations( const uint16_t *chans , uint8_t count ) {
+    stations = chans;
+    station_count = count;
+}
+
+void si4702_stub_reset(void) {
+
+    for( uint8_t i=0; i<16; i++ ) {
+        si4702_regs[i] = 0;
+    }
+
+    si4702_regs[0x00] = 0x1242;         // Part ID
+    si4702_regs[0x01] = 0x1253;         // Chip ID, Si4702 rev C
+    si4702_regs[0x07] = 0x0100;
+
+    op_pending = 0;
+    stc_clearing = 0;
+    glitches = 0;
+    powered = 0;
+}
+
+static uint8_t is_station( uint16_t chan ) {
+    for( uint8_t i=0; i<station_count; i++ ) {
+        if (stations[i] == chan) return 1;
+    }
+    return 0;
+}
+
+// Channels in the band for the spacing in 0x05, so we know how far a wrapping seek goes
+
+static uint16_t band_channels(void) {
+    static const uint16_t n[4] = { 103 , 206 , 411 , 411 };
+    return n[ (si4702_regs[0x05] >> 4) & 0x03 ];
+}
+
+static void start_op( uint16_t chan , uint32_t us , uint8_t fail ) {
+
+    double from = host_us > ready_at ? host_us : ready_at;
+
+    op_pending = 1;
+    op_done_at = from + us;
+    op_chan = chan;
+    op_fail = fail;
+}
+
+static void start_seek(void) {
+
+    uint16_t cur = si4702_regs[0x0b] & 0x03ff;
+
+    for( uint8_t i=0; i<station_count; i++ ) {
+        if (stations[i] > cur) {
+            start_op( stations[i] , (stations[i] - cur) * SEEK_US_PER_CHAN , 0 );
+            return;
+        }
+    }
+
+    if (station_count && !(si4702_regs[0x02] & (1<<10))) {           // SKMODE=0 wraps and carries on from the bottom
+        start_op( stations[0] , (band_channels() - cur + stations[0]) * SEEK_US_PER_CHAN , 0 );
+    } else {
+        start_op( cur , band_channels() * SEEK_US_PER_CHAN , 1 );    // Swept the whole band and found nothing
+    }
+}
+
+static void clear_stc(void) {
+    op_pending = 0;
+    stc_clearing = 0;
+    si4702_regs[0x0a] &= ~( (1<<14) | (1<<13) );
+}
+
+// SEEK or TUNE went low, so STC goes low a little later
+
+static void clear_stc_later(void) {
+    op_pending = 0;
+    stc_clearing = 1;
+    stc_clear_at = host_us + STC_CLEAR_US;
+}
+
+// Returns true if STC is still up, after dropping it if its time has come
+
+static uint8_t stc_up(void) {
+
+    if (stc_clearing && host_us >= stc_clear_at) {
+        stc_clearing = 0;
+        si4702_regs[0x0a] &= ~( (1<<14) | (1<<13) );        // Not clear_stc(), a seek started since is still going
+    }
+
+    return (si4702_regs[0x0a] & (1<<14)) != 0;
+}
+
+// Bring 0x0A and 0x0B up to date, called just before they are read out
+
+static void update_status(void) {
+
+    stc_up();
+
+    if (op_pending && host_us >= op_done_at) {
+
+        op_pending = 0;
+
+        si4702_regs[0x0b] = (si4702_regs[0x0b] & ~0x03ff) | op_chan;
+        si4702_regs[0x0a] |= (1<<14) | (op_fail ? (1<<13) : 0);
+    }
+
+    uint8_t rssi = is_station( si4702_regs[0x0b] & 0x03ff ) ? RSSI_STATION : RSSI_NOISE;
+
+    si4702_regs[0x0a] = (si4702_regs[0x0a] & 0xff00) | rssi;
+}
+
+static void write_reg( uint8_t reg , uint16_t value ) {
+
+    uint16_t old = si4702_regs[reg];
+
+    if (reg >= 0x0a) {
+        return;                         // Read only
+    }
+
+    si4702_regs[reg] = value;
+
+    if (reg == 0x02) {
+
+        uint8_t up = (value & 0x0001) && !(value & 0x0040);
+
+        if (up && !powered) {
+            ready_at = host_us + POWERUP_US;
+        }
+
+        if (!up) {
+            clear_stc();
+        }
+
+        powered = up;
+
+        if ((value & ~old) & (1<<8)) {
+            if (!stc_up()) {
+                start_seek();
+            }
+        } else if ((old & ~value) & (1<<8)) {
+            clear_stc_later();
+        }
+
+    } else if (reg == 0x03) {
+
+        if ((value & ~old) & (1<<15)) {
+            if (!stc_up()) {
+                start_op( value & 0x03ff , TUNE_US , 0 );
+            }
+        } else if ((old & ~value) & (1<<15)) {
+            clear_stc_later();
+        }
+    }
+}
+
+static uint8_t read_byte(void) {
+
+    uint8_t b;
+
+    if (reg_ptr == 0x0a && !lo_byte) {
+        update_status();
+    }
+
+    if (lo_byte) {
+        b = si4702_regs[reg_ptr] & 0xff;
+        reg_ptr = (reg_ptr + 1) & 0x0f;
+    } else {
+        b = si4702_regs[reg_ptr] >> 8;
+    }
+
+    lo_byte = !lo_byte;
+
+    return b;
+}
+
+// A full byte has been clocked in from the master
+
+static void got_byte( uint8_t b ) {
+
+    if (state == S_ADDR) {
+
+        if ((b >> 1) == SI4702_ADDRESS && glitches) {
+
+            glitches--;
+            acking = 0;
+            next_state = S_IGNORE;
+
+        } else if ((b >> 1) == SI4702_ADDRESS) {
+
+            acking = 1;
+
+            if (b & 1) {
+                next_state = S_READ;
+                reg_ptr = 0x0a;
+            } else {
+                next_state = S_WRITE;
+                reg_ptr = 0x02;
+            }
+            lo_byte = 0;
+
+        } else {
+            acking = 0;
+            next_state = S_IGNORE;
+        }
+
+    } else {
+
+        acking = 1;
+        next_state = S_WRITE;
+
+        if (lo_byte) {
+            write_reg( reg_ptr , (hi_hold << 8) | b );
+            reg_ptr = (reg_ptr + 1) & 0x0f;
+        } else {
+            hi_hold = b;
+        }
+        lo_byte = !lo_byte;
+    }
+}
+
+static void scl_rose(void) {
+
+    mockbus.clocks++;
+
+    if (state == S_IDLE || state == S_IGNORE) {
+        return;
+    }
+
+    clock++;
+
+    if (clock <= 8) {
+
+        if (state != S_READ) {
+            shift = (shift << 1) | line_sda;
+        }
+
+    } else {                            // (N)ACK bit, whoever is receiving looks at it now
+
+        if (line_sda) {
+            mockbus.nacks++;
+        }
+
+        nacked = line_sda;
+    }
+}
+
+static void scl_fell(void) {
+
+    if (state == S_IDLE || state == S_IGNORE) {
+        return;
+    }
+
+    if (clock < 8) {
+
+        if (state == S_READ) {
+            s_sda_low = !( (shift << clock) & 0x80 );
+        }
+
+    } else if (clock == 8) {
+
+        mockbus.bytes++;
+
+        if (state == S_READ) {
+            s_sda_low = 0;              // Let the master (N)ACK
+        } else {
+            got_byte( shift );
+            s_sda_low = acking;
+        }
+
+    } else {
+
+        clock = 0;
+        s_sda_low = 0;
+
+        if (state == S_READ) {
+            if (nacked) {
+                state = S_IGNORE;       // Done, wait for the STOP
+                return;
+            }
+        } else {
+            state = next_state;
+        }
+
+        if (state == S_READ) {
+            shift = read_byte();
+            s_sda_low = !(shift & 0x80);
+        }
+    }
+}
+
+// Work out the new line levels after anyone moved and run the slave on whatever changed
+
+static void lines_changed(void) {
+
+    uint8_t sda = !(m_sda_low || s_sda_low);
+    uint8_t scl = !m_scl_low;
+
+    if (sda != line_sda) mockbus.edges++;
+    if (scl != line_scl) mockbus.edges++;
+
+    if (scl != line_scl) {
+
+        line_scl = scl;
+        line_sda = sda;
+
+        if (scl) {
+            scl_rose();
+        } else {
+            scl_fell();
+        }
+
+        // The slave may have moved SDA on that edge
+
+        sda = !(m_sda_low || s_sda_low);
+        if (sda != line_sda) mockbus.edges++;
+        line_sda = sda;
+
+    } else if (sda != line_sda) {
+
+        line_sda = sda;
+
+        if (scl) {
+
+            if (!sda) {                 // START (or repeated START)
+                mockbus.transactions++;
+                busy = 1;
+                state = S_ADDR;
+                clock = 0;
+                shift = 0;
+                s_sda_low = 0;
+            } else {                    // STOP
+                busy = 0;
+                state = S_IDLE;
+                s_sda_low = 0;
+            }
+        }
+    }
+}
+
+void sda_drive_low(void) { m_sda_low = 1; lines_changed(); }
+void sda_pull_high(void) { m_sda_low = 0; lines_changed(); }
+void scl_drive_low(void) { m_scl_low = 1; lines_changed(); }
+void scl_pull_high(void) { m_scl_low = 0; lines_changed(); }
+
+uint8_t sda_read(void) {
+    return line_sda;
+}
+
+uint8_t scl_read(void) {
+    return line_scl;
+}
+
+void mockbus_glitch( uint8_t count ) {
+    glitches = count;
+}
+
+static void bus_delay( double us ) {
+
+    mockbus.bit_times++;
+
+    if (busy) {
+        mockbus.bus_us += us;
+    }
+
+    host_us += us;
+}
+
+void tlow_delay(void)  { bus_delay( TWI_TLOW_US ); }
+void thigh_delay(void) { bus_delay( TWI_THIGH_US ); }
@@ -0,0 +1,62 @@
+/***
+
+Mock TWI bus for host builds of the bit-banged engine in USI_TWI_Master.c (built with TWI_MOCK_BUS).
+
+The engine calls these instead of touching DDR_USI/PORT_USI/PIN_USI, and tlow_delay()/thigh_delay()
+instead of _delay_us(). The bus tracks the line levels, decodes START/STOP and bytes, and answers as
+a stub Si4702 at address 0x10. Time is kept in host_us, which the engine delays, the util/delay.h
+shims and the power_sleep() stand-in in twibench.c all advance, so the stub can time its seeks and
+tunes. It is a double since the fast mode delays are fractions of a microsecond.
+
+***/
+
+#include <stdint.h>
+
+// Bit-banged engine pin helpers, same meaning as the inline versions in USI_TWI_Master.c
+
+void sda_drive_low(void);
+void sda_pull_high(void);
+void scl_drive_low(void);
+void scl_pull_high(void);
+uint8_t sda_read(void);
+uint8_t scl_read(void);
+void tlow_delay(void);
+void thigh_delay(void);
+
+// Everything the bus has seen since the last mockbus_stats_reset()
+
+typedef struct {
+    uint32_t transactions;      // STARTs
+    uint32_t bytes;             // Including the address byte
+    uint32_t nacks;             // Bytes the receiver did not ACK (the last read byte of each transaction should be one)
+    uint32_t clocks;            // SCL rising edges
+    uint32_t edges;             // Level changes on either line
+    uint32_t bit_times;         // tlow_delay() and thigh_delay() calls
+    double   bus_us;            // Time spent with the bus not idle
+} mockbus_stats;
+
+extern mockbus_stats mockbus;
+
+void mockbus_stats_reset(void);
+
+extern double host_us;          // Wall time since power up
+
+void host_delay_us( double us );
+
+// Stub Si4702. Registers as the chip would return them, index is the register number.
+
+extern uint16_t si4702_regs[16];
+
+// Stations the stub seek and RSSI know about, READCHAN values lowest first.
+// Anything else reads back as a weak RSSI.
+
+void si4702_stub_stations( const uint16_t *chans , uint8_t count );
+
+// The stub does not ACK the next count address bytes meant for it, like a glitch on the bus would
+// do, so the engine has to notice and try again.
+
+void mockbus_glitch( uint8_t count );
+
+// Chip back to its power on state.
+
+void si4702_stub_reset(void);
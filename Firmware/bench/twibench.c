@@ -0,0 +1,288 @@
+/***
+
+Host benchmark for the TWI driver and the si4702_* register sequences in main.c.
+
+main.c is built right into this file against the host headers in bench/host and the mock bus in
+mockbus.c, so the sequences that run are exactly the ones in the firmware. Each step below runs
+one of them against a stub Si4702 and reports what it cost on the bus:
+
+    trans       TWI transactions (STARTs)
+    bytes       Bytes on the bus, address bytes included
+    nacks       Bytes not ACKed. A read should have exactly one, the last byte.
+    clocks      SCL clocks
+    edges       Level changes on SCL and SDA
+    bus_us      Time with the bus busy, from the engine's bit delays
+    wall_ms     Time including any sleeps, as the chip would see it
+
+The byte counts are deterministic, so each step has a budget. If a change makes a step use
+more bytes than its budget the bench says so and exits with 1. If a step got cheaper it says
+that too, so the budget can be tightened.
+
+    make twibench                   ATTiny25 (no station table)
+    make twibench PART=attiny45     Production units, also covers the band scan
+
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mockbus.h"
+
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+// I/O registers for bench/host/avr/io.h
+
+volatile uint8_t PORTB, DDRB, PINB = _BV( BUTTON_INPUT_BIT );        // Button is pulled up
+volatile uint8_t PRR, GIMSK, PCMSK, WDTCR, MCUCR, SREG;
+
+uint8_t host_eeprom[E2END + 1];
+uint32_t host_eeprom_writes;
+
+// Power.c stand-ins. Only the WDT can wake us on the bench, so sleeping just moves the clock on to when it fires.
+
+void power_sleep(void) {
+
+    if (!(WDTCR & _BV(WDIE))) {
+        fprintf( stderr , "Sleeping with no WDT, would never wake up\n" );
+        exit(2);
+    }
+
+    host_us += (uint64_t) (TIMER_TICK_MS * 1000UL) << shiftFromHowlong( WDTCR );
+
+    WDT_vect();
+}
+
+void power_init(void) {}
+void power_down(void) {}
+void power_up(void) {}
+void power_off(void) {
+    fprintf( stderr , "Powered off for good\n" );
+    exit(2);
+}
+
+// VccADC and LedPWM stand-ins. The battery is always good and the LED is never running.
+
+void adc_on(void) { CLOCK_CHECK_FULL(); }
+void adc_off(void) {}
+uint16_t readADC(void) { CLOCK_CHECK_FULL(); return VCC2ADC( 3.0 ); }
+uint16_t readVcc(void) { CLOCK_CHECK_FULL(); return VCC2ADC( 3.0 ) * VCC_OVERSAMPLE; }
+uint16_t vcc_threshold( uint16_t bandgap_mv , uint16_t vcc_mv ) { return ( (uint32_t) bandgap_mv * (1023UL * VCC_OVERSAMPLE) ) / vcc_mv; }
+
+// The bench keeps time in the engine delays and the delay shims, so the clock speed makes no difference
+// here. It is still tracked, so the bench fails if anything delays or reads the ADC with it moved.
+
+static uint8_t bench_clock_div = CLOCK_DIV_FULL;
+
+void clock_set( uint8_t div ) { bench_clock_div = div; }
+
+void clock_check_full( void ) {
+
+    if (bench_clock_div != CLOCK_DIV_FULL) {
+        fprintf( stderr , "Delay or ADC use with the clock at CLOCK_HZ(%u)\n" , bench_clock_div );
+        exit(2);
+    }
+}
+
+void led_pwm_off(void) {}
+void led_pwm_breathe( uint8_t count , uint8_t duty ) {}
+void led_pwm_blink( uint8_t count , uint8_t duty ) {}
+uint8_t led_pwm_running(void) { return 0; }
+
+// Stations on the band, 200KHz spacing from 87.5MHz. The seed tunes to 68 (101.1MHz).
+
+static const uint16_t bench_stations[] = { 8 , 22 , 48 , 68 , 83 };
+
+#define SEED_CHANNEL    (68)
+
+// Same image eeprom.py makes: band 0, 75uS, 200KHz, volume 15. Ring and station table blank.
+
+static void seed_eeprom(void) {
+
+    param_block seed = { .band = 0 , .deemphasis = 0 , .spacing = 0 , .channel = SEED_CHANNEL , .volume = 15 };
+
+    seed.crc16 = param_crc( &seed , offsetof( param_block , crc16 ) );
+
+    for( unsigned i=0; i<sizeof(host_eeprom); i++ ) {
+        host_eeprom[i] = 0xff;
+    }
+
+    eeprom_update_block( &seed , (void *)EEPROM_WORKING , sizeof(seed) );
+    eeprom_update_block( &seed , (void *)EEPROM_FACTORY , sizeof(seed) );
+}
+
+// In the firmware the steps are a button press or more apart, so give the stub that long to settle
+// between them, or it would see a tune right on the heels of the last one
+
+#define BENCH_STEP_GAP_US   (10000)
+
+static void step_init(void)      { si4702_init(); }
+static void step_enable(void)    { si4702_enable(); }
+static void step_tune(void)      { si4702_tune( params.channel ); }
+static void step_status(void)    { si4702_read_registers_upto( REGISTER_0A ); }
+static void step_readchan(void)  { si4702_read_registers_upto( REGISTER_0B ); }
+
+// A seek should go out muted and come back unmuted once it lands
+
+static void step_seek(void) {
+
+    seekNext();
+
+    if (si4702_regs[0x02] & _BV( REG_02_DMUTE_BIT )) {
+        fprintf( stderr , "Seek not muted\n" );
+        exit(1);
+    }
+}
+
+static void step_seekwait(void) {
+
+    seekFinish();
+
+    if ((si4702_regs[0x02] & (_BV( REG_02_DMUTE_BIT ) | _BV( REG_02__SEEK ))) != _BV( REG_02_DMUTE_BIT )) {
+        fprintf( stderr , "Seek done but not unmuted with SEEK clear\n" );
+        exit(1);
+    }
+}
+
+// A press while a seek is still sweeping has to get the run() loop straight back round to handle it,
+// without sleeping on (which only the release would wake) or polling the seek any further
+
+static void step_seekpress(void) {
+
+    double start = host_us;
+
+    PINB &= ~_BV( BUTTON_INPUT_BIT );
+
+    idleUntilNext( readVcc() );
+
+    PINB |= _BV( BUTTON_INPUT_BIT );
+
+    if (host_us != start || !seek_polls) {
+        fprintf( stderr , "Press during a seek did not go straight back round\n" );
+        exit(1);
+    }
+}
+
+// One NACKed address should cost one retry, and a bus that never answers TWI_TRIES attempts and no more
+
+static void step_glitch(void) {
+
+    mockbus_glitch( 1 );
+
+    if (si4702_read_registers_upto( REGISTER_0A )) {
+        fprintf( stderr , "Retry did not get past a single glitch\n" );
+        exit(1);
+    }
+}
+
+static void step_deadbus(void) {
+
+    mockbus_glitch( TWI_TRIES );
+
+    if (si4702_read_registers_upto( REGISTER_0A ) != USI_TWI_NO_ACK_ON_ADDRESS) {
+        fprintf( stderr , "Dead bus not reported as no ACK on address\n" );
+        exit(1);
+    }
+}
+static void step_save(void)      { updateToCurrentChannel(); }
+static void step_powerdown(void) { si4702_powerdown(); }
+static void step_resume(void)    { si4702_resume(); }
+
+#ifdef STATION_TABLE
+static void step_scan(void)      { stationScan(); }
+static void step_next(void)      { stationNext(); }
+#endif
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+    uint32_t budget;        // Most bytes this step should take
+    uint16_t chan;          // READCHAN the stub should be on afterwards, 0 to not check
+} bench_step;
+
+// In the order the firmware does them, since each step starts from where the last one left the chip
+
+static const bench_step steps[] = {
+    { "init"      , step_init      ,  13 , 0 },
+    { "enable"    , step_enable    ,  14 , 0 },
+    { "tune"      , step_tune      ,  40 , SEED_CHANNEL },
+    { "status"    , step_status    ,   3 , 0 },
+    { "glitch"    , step_glitch    ,   4 , 0 },
+    { "deadbus"   , step_deadbus   ,   3 , 0 },
+    { "readchan"  , step_readchan  ,   5 , 0 },
+    { "seek"      , step_seek      ,   5 , 0 },
+    { "reseek"    , step_seek      ,   8 , 0 },     // Press again mid-seek, which restarts it
+    { "seekpress" , step_seekpress ,   0 , 0 },
+    { "seekwait"  , step_seekwait  ,  45 , 83 },
+    { "seek"      , step_seek      ,   5 , 0 },
+    { "seekwait"  , step_seekwait  ,  84 , 8 },     // Wraps past the top of the band
+    { "save"      , step_save      ,   5 , 0 },
+    { "powerdown" , step_powerdown ,   8 , 0 },
+    { "resume"    , step_resume    ,  57 , 8 },
+#ifdef STATION_TABLE
+    { "scan"      , step_scan      , 451 , 8 },     // The last seek wraps back to the bottom station
+    { "next"      , step_next      ,  22 , 8 },
+#endif
+};
+
+// The bench never runs the real power_init(), so check what it would put in DIDR0 here. On the X5
+// each DIDR0 bit turns off the input of the pin with the same number, and a pin with its input off
+// reads 0. With SCL in there every clock release times out and no transaction ever gets through.
+
+#define BENCH_READ_PINS     ( _BV(PB0) | _BV(PB2) | _BV( BUTTON_INPUT_BIT ) )      // SDA, SCL, button
+
+int main(void) {
+
+    int status = 0;
+
+    if (POWER_DIDR0 & BENCH_READ_PINS) {
+        printf( "POWER_DIDR0 turns off the input of a pin we read (0x%02x)\n" , POWER_DIDR0 & BENCH_READ_PINS );
+        return 1;
+    }
+
+    seed_eeprom();
+
+    si4702_stub_reset();
+    si4702_stub_stations( bench_stations , sizeof(bench_stations) / sizeof(bench_stations[0]) );
+
+    find_working_param();
+
+    host_eeprom_writes = 0;
+
+    printf( "%-10s %6s %6s %6s %6s %6s %8s %8s\n" , "step" , "trans" , "bytes" , "nacks" , "clocks" , "edges" , "bus_us" , "wall_ms" );
+
+    for( unsigned i=0; i<sizeof(steps)/sizeof(steps[0]); i++ ) {
+
+        const bench_step *s = &steps[i];
+
+        host_us += BENCH_STEP_GAP_US;
+
+        mockbus_stats_reset();
+        double start = host_us;
+
+        s->run();
+
+        printf( "%-10s %6u %6u %6u %6u %6u %8.1f %8.1f" , s->name ,
+                mockbus.transactions , mockbus.bytes , mockbus.nacks , mockbus.clocks , mockbus.edges , mockbus.bus_us ,
+                (host_us - start) / 1000.0 );
+
+        if (mockbus.bytes > s->budget) {
+            printf( "  OVER BUDGET (%u)" , s->budget );
+            status = 1;
+        } else if (mockbus.bytes < s->budget) {
+            printf( "  under budget (%u), tighten it" , s->budget );
+        }
+
+        if (s->chan && (si4702_regs[0x0b] & 0x03ff) != s->chan) {
+            printf( "  WRONG CHANNEL %u, expected %u" , si4702_regs[0x0b] & 0x03ff , s->chan );
+            status = 1;
+        }
+
+        printf( "\n" );
+    }
+
+    printf( "EEPROM bytes written: %u\n" , host_eeprom_writes );
+
+    return status;
+}
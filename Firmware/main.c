@@ -39,16 +39,21 @@
  *   - writes on the other hand always start with register 0x2 (power config).
  *   - we should only ever need to write registers 0x2 thru 0x7
  *
- *   - We will *always* read all 16 registers, and store them in AVR RAM.
+ *   - We only ever read registers 0xA and 0xB (status, RSSI, READCHAN),
+ *     so a read never goes past the first 4 bytes the chip sends.
  *   - We will only ever write registers 2 - 7 (6 total), and we will write
  *     them from the same shadow storage in AVR RAM.
  *
  *   - To change a register, we will modify the shadow registers in place
- *     and then write back the entire bank of 6.
+ *     and then flush them back to the chip. The shadow layer remembers the
+ *     highest register that actually changed value since the last flush,
+ *     so a flush writes 0x2 up to that register and no further (writes
+ *     must start at 0x2), and does nothing at all if no register changed.
  *
- *   - The Tiny25 has limited resources, to preserve these, the shadow
- *     registers are not laid out from 0 in AVR memory, but rather from 0xA
- *     as follows:
+ *   - The Tiny25 has limited resources, to preserve these, the shadow only
+ *     has room for the registers we use, 16 bytes rather than all 32. The
+ *     read registers come first, since reads start at 0xA, and the write
+ *     registers follow, since writes start at 0x2:
  *
  *     +--------------+-----------+
  *     |              | High Byte |   <--- Byte offset: 0
@@ -60,64 +65,36 @@
  *     |              |  Low Byte |   <--- Byte offset: 3
  *     +--------------+-----------+
  *     |              | High Byte |   <--- Byte offset: 4
- *     | Register 0xC |===========|
+ *     | Register 0x2 |===========|
  *     |              |  Low Byte |   <--- Byte offset: 5
  *     +--------------+-----------+
  *     |              | High Byte |   <--- Byte offset: 6
- *     | Register 0xD |===========|
+ *     | Register 0x3 |===========|
  *     |              |  Low Byte |   <--- Byte offset: 7
  *     +--------------+-----------+
  *     |              | High Byte |   <--- Byte offset: 8
- *     | Register 0xE |===========|
+ *     | Register 0x4 |===========|
  *     |              |  Low Byte |   <--- Byte offset: 9
  *     +--------------+-----------+
  *     |              | High Byte |   <--- Byte offset: 10
- *     | Register 0xF |===========|
+ *     | Register 0x5 |===========|
  *     |              |  Low Byte |   <--- Byte offset: 11
  *     +--------------+-----------+
  *     |              | High Byte |   <--- Byte offset: 12
- *     | Register 0x0 |===========|
+ *     | Register 0x6 |===========|
  *     |              |  Low Byte |   <--- Byte offset: 13
  *     +--------------+-----------+
  *     |              | High Byte |   <--- Byte offset: 14
- *     | Register 0x1 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 15
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 16
- *     | Register 0x2 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 17
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 18
- *     | Register 0x3 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 19
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 20
- *     | Register 0x4 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 21
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 22
- *     | Register 0x5 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 23
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 24
- *     | Register 0x6 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 25
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 26
  *     | Register 0x7 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 27
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 28
- *     | Register 0x8 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 29
- *     +--------------+-----------+
- *     |              | High Byte |   <--- Byte offset: 30
- *     | Register 0x9 |===========|
- *     |              |  Low Byte |   <--- Byte offset: 31
+ *     |              |  Low Byte |   <--- Byte offset: 15
  *     +--------------+-----------+
  *
- *   - Because registers 2 thru 7 don't wrap in the buffer, we can use
- *     contiguous read *and* write function.
+ *   - Registers 0xC - 0xF and 0x0 - 0x1 sit between 0xB and 0x2 in the
+ *     chip's read order, but since no read goes past 0xB they are never
+ *     clocked at all, let alone stored. Same for 0x8 and 0x9 after 0x7 on
+ *     the way out. Reads of 0xA - 0xB and writes of 0x2 - 0x7 are each
+ *     contiguous in the buffer, so we can use plain read *and* write
+ *     functions.
  *   - The goal here is to get the pre-processor to do as much of the work
  *     for us as possible, especially since we only ever need to access
  *     registers by name, not algorithmically.
@@ -127,21 +104,26 @@
  * 
  */
 #include <inttypes.h>
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <util/atomic.h>
-#include <avr/sleep.h>
 #include <avr/eeprom.h>
 #include <util/crc16.h>
 #include <avr/wdt.h>
 
-#define	F_CPU	1000000UL
+#include "Clock.h"
 #include <util/delay.h>
 
 
 #include "USI_TWI_Master.h"
 #include "VccADC.h"
+#include "VccProg.h"
+#include "LedPWM.h"
+#include "Profile.h"
+#include "Power.h"
+#include "Telemetry.h"
 
 #define FMIC_ADDRESS        (0b0010000)                // Hardcoded for this chip, "a seven bit device address equal to 0010000"
 
@@ -153,6 +135,9 @@
 #define BUTTON_INPUT_BIT    PB3
 #define BUTTON_PCINT_BIT    PCINT3
 #define LONG_PRESS_MS       (2000)      // Hold down button this long for a long press
+#define VERY_LONG_PRESS_MS  (4000)      // ...and this long for a factory reset request
+#define RESET_CONFIRM_MS    (10000)     // How long a factory reset request waits for the long press that confirms it
+#define RESET_FLASH_MS      (160)       // LED flashes this long on, this long off while it waits
 #define BUTTON_DEBOUNCE_MS  (50)        // How long to debounce button edges
 
 
@@ -163,12 +148,18 @@
 #define LOW_BATTERY_VOLTAGE_WARM_COUNT  10      // We need to see this many consecutive low battery voltage readings before shutting down
                                                 // this prevents us from shutting down based on seeing one sample that might have happened 
                                                 // right when the amp was pulling a spike of current. 
+                                                // Readings are 1 second apart whenever we are below LOW_BATTERY_VOLTAGE_NEAR, so this is also seconds.
+
+#define LOW_BATTERY_VOLTAGE_NEAR (1.95)         // Below this we are getting close to LOW_BATTERY_VOLTAGE_WARM, so check the battery every second 
+                                                // instead of every 8. Must be above LOW_BATTERY_VOLTAGE_WARM.
                                                 
                                                 
 // TODO: Empirically figure out optimal values for low battery voltages
 
 #define LED_COUNT (2)       // How many initial breaths should we display? Resets on startup and after each button press. Each breath currently about 2 secs.
 
+#define LED_BADEEPROM_DUTY  (128)   // Battery is good, so we can afford to save some power on this blink
+
 // These are the error display codes
 // When we run into problems, we blink the LED this many times to show the user
 // Note that 1 blink is skipped intentionally for UX reasons. Is a single blink a single blink, or an infinite number of blinks? Think about it!
@@ -186,26 +177,17 @@
 #define TBI(port,bit) (port&_BV(bit))
 
 typedef enum {
-	REGISTER_00 = 12,
-	REGISTER_01 = 14,
-	REGISTER_02 = 16,
-	REGISTER_03 = 18,
-	REGISTER_04 = 20,
-	REGISTER_05 = 22,
-	REGISTER_06 = 24,
-	REGISTER_07 = 26,
-	REGISTER_08 = 28,
-	REGISTER_09 = 30,
 	REGISTER_0A =  0,
 	REGISTER_0B =  2,
-    
+	REGISTER_02 =  4,
+	REGISTER_03 =  6,
+	REGISTER_04 =  8,
+	REGISTER_05 = 10,
+	REGISTER_06 = 12,
+	REGISTER_07 = 14,
+
+    // No slot for 0x0C - 0x0F, 0x00 - 0x01 or 0x08 - 0x09, see the layout at the top.
 
-    // These not used in current implementation. 
-	REGISTER_0C =  4,
-	REGISTER_0D =  6,
-	REGISTER_0E =  8,
-	REGISTER_0F = 10,
-        
 } si4702_register;
 
 
@@ -218,6 +200,7 @@ typedef enum {
 #define REG_02_SKMODE           10          // 0 = Wrap at the upper or lower band limit and continue seeking (default). 1 = Stop seeking at the upper or lower band limit.
 #define REG_02_SEEKUP_BIT        9          // 0 = Seek down (default). 1 = Seek up.
 #define REG_02__SEEK             8          // This is a command. 1 = Enable. A seek operation may be aborted by setting SEEK = 0.
+#define REG_02_DISABLE_BIT       6          // Set along with ENABLE to powerdown. Registers are kept.
 #define REG_02_ENABLE_BIT        0          // Power up enable
 
 #define REG_02_DEFAULT ( _BV( REG_02_DMUTE_BIT) |  _BV(REG_02_MONO_BIT) | _BV(REG_02_ENABLE_BIT) | _BV(REG_02_SEEKUP_BIT) )    // Used mostly when setting and clearing seek bit
@@ -225,24 +208,107 @@ typedef enum {
 
 #define REG_04_DE_BIT       11          // Deemphasis
 
+#define REG_0A_STC_BIT      14          // Seek/Tune Complete. Set when a seek or tune finishes, cleared by clearing SEEK or TUNE
+#define REG_0A_SFBL_BIT     13          // Seek Fail/Band Limit
+
 #define REG_07_XOSCEN       15          // Enable crystal oscillator
 #define REG_07_AHIZEN       14          // Audio high-Z enable
 
 
-#define EEPROM_BAND		    ((const uint8_t *)0)
-#define EEPROM_DEEMPHASIS	((const uint8_t *)1)
-#define EEPROM_SPACING		((const uint8_t *)2)
-#define EEPROM_CHANNEL		((const uint16_t *)3)
-#define EEPROM_VOLUME		((const uint8_t *)5)
-#define	EEPROM_CRC16		((const uint16_t *)14)      // Each block has an independent CRC-16
+// A parameter block, exactly as laid out in EEPROM. Must match the '<BBBHB8x' + CRC-16 that eeprom.py packs.
+// Multi-byte fields are little endian in EEPROM, which is also how the AVR keeps them in RAM.
+
+typedef struct {
+	uint8_t  band;
+	uint8_t  deemphasis;
+	uint8_t  spacing;
+	uint16_t channel;
+	uint8_t  volume;
+	uint8_t  pad[7];
+	uint8_t  sequence;          // Last pad byte. Only meaningful in ring records, 0 in images from eeprom.py
+	uint16_t crc16;             // Each block has an independent CRC-16
+} __attribute__((packed)) param_block;
 
-#define EEPROM_PARAM_BLOCK_SIZE	(16)
+#define EEPROM_PARAM_BLOCK_SIZE	(sizeof(param_block))
 
 // Starting address of parameter blocks in EEPROM. Can't overlap and must match with other tools that make EEPROM images
 
-#define	EEPROM_WORKING		((const uint8_t *) 0)
+#define	EEPROM_WORKING		((const uint8_t *) 0)       // Seed block as programmed by eeprom.py. Never written by firmware.
 #define EEPROM_FACTORY		((const uint8_t *)16)
 
+// Manufacturing record lives at 32-82 and is never touched by firmware.
+
+// Bandgap calibration, written for each unit at production test by eeprom.py -B from the bandgap as
+// measured on the bench. check is ~bandgap_mv, so an erased (0xff) or half written record fails and
+// we use VCC_BANDGAP_MV. Never written by firmware.
+
+typedef struct {
+	uint16_t bandgap_mv;
+	uint16_t check;
+} __attribute__((packed)) calibration_block;
+
+#define EEPROM_CALIBRATION  ((const calibration_block *)92)     // Just below the ring
+
+// Every channel save goes into the next slot of a ring of parameter blocks above the manufacturing record,
+// so no single EEPROM cell takes all the writes. Each record carries a sequence number that is one more than
+// the record before it, and the record with the newest sequence number and a good CRC wins at boot.
+// A write that gets cut short (battery dying) just leaves a bad CRC in that slot and we fall back to the previous
+// record. If there are no good records (fresh image from eeprom.py always blanks the ring) we use EEPROM_WORKING.
+
+#define EEPROM_RING         ((const uint8_t *)96)
+
+#if E2END < 0xff
+    #define EEPROM_RING_SLOTS   (2)         // ATTINY25 only has 128 bytes of EEPROM
+#else
+    #define EEPROM_RING_SLOTS   (4)
+#endif
+
+#define EEPROM_RING_END     (EEPROM_RING + (EEPROM_RING_SLOTS * EEPROM_PARAM_BLOCK_SIZE))
+
+// Station table filled in by a band scan, so a short press can go straight to the next station with
+// one tune instead of a blind seek. Only fits on parts with more than 128 bytes of EEPROM. Without it we just seek.
+
+#if E2END >= 0xff
+
+    #define STATION_TABLE
+
+    #define STATION_TABLE_SIZE  (15)
+
+    typedef struct {
+        uint8_t  count;                         // 0xff (blank) or 0 means scan before the next step
+        uint16_t chan[STATION_TABLE_SIZE];      // READCHAN values, lowest first
+    } __attribute__((packed)) station_table;
+
+    #define EEPROM_STATIONS     ((station_table *)160)
+
+#endif
+
+// Field telemetry ring, see Telemetry.h. Same parts as the station table, and sits between it and the profiler record.
+
+#ifdef TELEMETRY
+
+    #define EEPROM_TELEMETRY    ((void *)192)
+
+#endif
+
+// Phase profiler record, only written in PROFILE builds. See Profile.h.
+
+#ifdef PROFILE
+
+    #if E2END < 0xff
+        #error "PROFILE needs more than 128 bytes of EEPROM"
+    #endif
+
+    #define EEPROM_PROFILE      ((void *)224)
+
+#endif
+
+// EEPROM address of the parameter block we are running from, and a RAM copy of it.
+// Both set at boot by find_working_param(). Everything else reads params from the RAM copy.
+
+static const uint8_t *working_param;
+static param_block params;
+
 
 static inline void LED_on(void) {
    // Very quick blink LED twice
@@ -256,54 +322,96 @@ static inline void LED_off(void) {
 }  
 
 
-static uint8_t shadow[32];
+#define SHADOW_SIZE (REGISTER_07 + 2)
+
+static uint8_t shadow[SHADOW_SIZE];
+
+// Byte offset just past the highest shadow register that has changed since the last flush.
+// 0 means nothing to write. Since every writable register lives above REGISTER_02 in the
+// shadow, this is also the end of the minimal write that starts at 0x02.
+
+static uint8_t shadow_dirty_end;
 
 static uint16_t get_shadow_reg(si4702_register reg)
 {
 	return (shadow[reg] << 8) | (shadow[reg + 1]);
 }
 
-// Making this a macro saves 20 bytes of precious flash
+// Only registers 0x02 - 0x07 should ever be set here, since those are the only ones we write.
+// This used to be a macro to save flash, but now that it also tracks the dirty range a
+// single out-of-line copy is smaller than expanding the compare at every call site.
 
-#define set_shadow_reg(reg,value) shadow[reg] = (value) >> 8; shadow[reg + 1] = (value) & 0xff
+static void set_shadow_reg(si4702_register reg, uint16_t value)
+{
+    if (get_shadow_reg(reg) != value) {
 
-// Real code for above macro for clarity (but unused here to save space)
+        shadow[reg] = value >> 8;
+        shadow[reg + 1] = value & 0xff;
 
-static inline void set_shadow_reg_non_macro(si4702_register reg, uint16_t value)
-{
-	shadow[reg] = value >> 8;
-	shadow[reg + 1] = value & 0xff;
+        if (shadow_dirty_end < reg + 2) {
+            shadow_dirty_end = reg + 2;
+        }
+    }
 }
 
-// Read registers 0x0a and 0x0b from FM_IC.
-// We really only care about 0x0b because this is where the current channel is saved after a seek.
-// We have to read both because all TWO reads on this chip start at register 0x0a (they wraps around to at 0x0f) 
-// We need 0x03 so we can check what station we landed on after a seek.
+// Read registers from the FM_IC into the shadow, starting at 0x0a and going up to and including reg.
+// All TWO reads on this chip start at register 0x0a (they wrap around from 0x0f to 0x00), which is why the shadow
+// starts with 0x0a and 0x0b. So reg's offset in the shadow plus 2 is exactly how many bytes we need to clock out.
+// Use REGISTER_0A for just the status and RSSI (2 bytes), REGISTER_0B to also get READCHAN after a seek or tune.
+// Nothing past 0x0b, the chip would send 0x0c next and that has no slot.
 
-static void si4702_read_registers_upto_0B(void)
+// Returns 0 on success. If the read failed after all its retries, what is in the shadow is garbage.
+
+static uint8_t si4702_read_registers_upto(si4702_register reg)
 {
-    USI_TWI_Read_Data( FMIC_ADDRESS , shadow , REGISTER_0B - REGISTER_0A + 2 );      // Total of 10 registers,  each 2 bytes
+    return USI_TWI_Read_Data( FMIC_ADDRESS , shadow , reg + 2 );
 }
 
 /*
- * Just write registers 2 thru 7 inclusive from the shadow array.
+ * Flush changed registers from the shadow array to the chip.
  */
 
-// Writes registers starting at 0x02 up to and including the specified upto_reg (max 0x09) 
+// Writes registers starting at 0x02 up to and including the highest register changed since
+// the last flush, and skips the bus transaction completely if nothing changed.
 // No reason to overwrite registers that we have not changed - especially 0x07 which has conflicting
 // documentation about what to write there after powerup. Better to leave it be!
 
-static void si4702_write_registers(unsigned upto_reg)
+static void si4702_flush_registers(void)
 {
-	//USI_TWI_Start_Transceiver_With_Data(0x20, &(shadow[REGISTER_02]), 12);
-        
-    // Only registers 0x02 - 0x07 are relevant for config, and each register is 2 bytes wide
-    
-    USI_TWI_Write_Data( FMIC_ADDRESS ,  &(shadow[REGISTER_02]) , ( upto_reg - REGISTER_02 + 2) );
+    if (shadow_dirty_end) {
+
+        // Only registers 0x02 - 0x07 are relevant for config, and each register is 2 bytes wide
+
+        if (!USI_TWI_Write_Data( FMIC_ADDRESS ,  &(shadow[REGISTER_02]) , ( shadow_dirty_end - REGISTER_02 ) )) {
+            shadow_dirty_end = 0;           // Leave dirty on failure so the next flush tries again
+        }
+    }
 }
 
 
 
+// Just the top half of 0x0A, which has STC and SF/BL. Leaves the RSSI in the shadow as it was.
+
+#define SI4702_STATUS_BYTES (1)
+
+// Flush changed registers like si4702_flush_registers(), and read the status back right behind them in the
+// same transaction with a repeated START, so we see what the chip made of the write. With nothing to flush
+// this is just the status read. Returns 0 on success, and on failure the status in the shadow is garbage.
+
+static uint8_t si4702_flush_registers_read_status(void)
+{
+    uint8_t count = shadow_dirty_end ? shadow_dirty_end - REGISTER_02 : 0;
+
+    if (USI_TWI_Write_Read_Data( FMIC_ADDRESS , &(shadow[REGISTER_02]) , count , shadow , SI4702_STATUS_BYTES )) {
+        return 1;                       // Leave dirty so the next flush tries again
+    }
+
+    shadow_dirty_end = 0;
+
+    return 0;
+}
+
+
 /*
  * Seek thresholds - see Appendix of SiLabs AN230
  * TODO: Set these according to AN284?
@@ -316,30 +424,58 @@ static void si4702_write_registers(unsigned upto_reg)
 
 
 /*
- * update_channel() -	Update the channel stored in the working params.
- *			Just change the 2 bytes @ EEPROM_CHANNEL,
- *			recalculate the CRC, and then write that.
+ * param_crc() -	CRC-16 over the first len bytes of a parameter block in RAM.
+ *			Over the whole block (including the stored CRC) this comes
+ *			out 0x0000 if the block is good.
  */
-static void update_channel(uint16_t channel)
+static uint16_t param_crc(const param_block *block, uint8_t len)
 {
 	uint16_t crc = 0x0000;
-	const uint8_t *src;
+	const uint8_t *src = (const uint8_t *)block;
 
-	eeprom_write_word((uint16_t *)EEPROM_CHANNEL, channel);
+	while (len--) {
+		crc = _crc16_update(crc, *src++);
+	}
 
-	/*
-	 * Spin through the working params, up to but not including the CRC
-	 * calculating the new CRC and write that.
-	 */
-	for (src = EEPROM_WORKING; src < (const uint8_t *)EEPROM_CRC16; src++) {
-		crc = _crc16_update(crc, eeprom_read_byte(src));
+	return crc;
+}
+
+/*
+ * write_working_param() -	Append params to the ring.
+ *				Bumps the sequence number, calculates the CRC in RAM
+ *				and writes the block into the slot after the current one.
+ *				Only bytes that differ from what is already in that slot get
+ *				written, which is usually just the channel, sequence and CRC.
+ */
+static void write_working_param(void)
+{
+	const uint8_t *dest = working_param + EEPROM_PARAM_BLOCK_SIZE;
+
+	if (working_param < EEPROM_RING || dest >= EEPROM_RING_END) {
+		dest = EEPROM_RING;             // Start of ring, or wrap around
 	}
 
-	eeprom_write_word((uint16_t *)EEPROM_CRC16, crc);
-    
+	params.sequence++;
+
+	params.crc16 = param_crc(&params, offsetof(param_block, crc16));
+
+	eeprom_update_block(&params, (void *)dest, EEPROM_PARAM_BLOCK_SIZE);
+
+	working_param = dest;
 }
 
-// Note: must read the registers from the FM_IC first with si4702_read_registers_upto_0B()
+/*
+ * update_channel() -	Update the channel stored in the working params.
+ *			Just change the channel in RAM, and append it to the ring.
+ */
+static void update_channel(uint16_t channel)
+{
+	params.channel = channel;
+
+	write_working_param();
+}
+
+// Note: must read the registers from the FM_IC first with si4702_read_registers_upto( REGISTER_0B )
 // THis gets the current channel after a seek.
 
 /*
@@ -355,15 +491,20 @@ with the bits SPACE 05h[5:4] and CHAN 03h[9:0].
 
 
 static uint16_t currentSeekChanFromShadow(void) {
-    return( get_shadow_reg(REGISTER_0B & 0x1ff));
+    return( get_shadow_reg(REGISTER_0B) & 0x03ff);          // READCHAN is the low 10 bits, the rest is RDS status
 }    
 
 // read the current channel from the RF-IC and save to eeprom. 
 // We need this on a long press to save a new station after a seek.
+// A seek still sweeping would give us wherever it has got to, so let it land first.
+
+static uint8_t seekFinish(void);
 
 static void updateToCurrentChannel(void) {
     
-    si4702_read_registers_upto_0B();
+    seekFinish();
+    
+    si4702_read_registers_upto( REGISTER_0B );
     
     update_channel( currentSeekChanFromShadow() ); 
     
@@ -372,13 +513,30 @@ static void updateToCurrentChannel(void) {
 
 
 // Issue a seek, come what may.
-// Note that state gets mussy here. We don't check for when the seek ends because it would use
-// previous code space and also checking messes with the RFIC and can cause us to miss stations.
 // We just blindly send the seek command even if there is already a seek in progress. It is going to be ok. 
+// The seek runs muted. seekPoll() watches for it to end from the run() loop, then unmutes.
 
 // Seek settings taken from original version of this code.
 // TODO: Should we adjust seek settings based on AN284 app note?
 
+// Each poll for STC to drop is a 2 byte status read and a short wait. All the polls add up to well
+// past the 1ms fixed wait that always worked.
+
+#define SEEK_RESTART_POLLS      (16)
+#define SEEK_RESTART_POLL_US    (100)
+
+// A seek can sweep most of the band before it finds something. We poll slower than for a tune since
+// every status read disturbs the seek a little.
+
+#define SEEK_POLLS              (250)       // ~16s at 64ms, plenty for a whole band at 50KHz spacing
+#define SEEK_POLL_HOWLONG       HOWLONG_64MS
+
+// Same as REG_02_DEFAULT but muted, so we do not hear the sweep
+
+#define REG_02_SEEKING          ( REG_02_DEFAULT & ~_BV( REG_02_DMUTE_BIT ) )
+
+static uint8_t seek_polls;          // Polls left on the seek we started, 0 once it is done (or there never was one)
+
 static void seekNext(void) {
                 
         /* 
@@ -387,82 +545,279 @@ static void seekNext(void) {
         before the next seek or tune may begin/"        
         */
                 
-                                
-    set_shadow_reg(REGISTER_02, REG_02_DEFAULT  );            
-    
-    si4702_write_registers( REGISTER_02 );
+    // STC takes a moment to drop after SEEK (or TUNE, after a tune) is cleared, and setting SEEK before
+    // then does nothing. We used to wait an empirically determined 1ms here. Instead, read the status
+    // right behind the clear (one transaction, repeated START) and set SEEK as soon as STC is down,
+    // which is usually on that first read. If it somehow never drops we seek anyway, same as always.
     
-    // Empirically determined that we need this delay.
-    // We we follow the stop with a start immediately, it does not work. 
-    // 1ms was the 1st guess and it worked. 
-   
+    uint8_t polls = SEEK_RESTART_POLLS;
+                                
+    set_shadow_reg(REGISTER_02, get_shadow_reg(REGISTER_02) & ~_BV(REG_02__SEEK) );     // Still muted if we are cutting into a seek
     
-    _delay_ms(1);
-                
+    while ( (si4702_flush_registers_read_status() || (get_shadow_reg(REGISTER_0A) & _BV( REG_0A_STC_BIT ))) && --polls ) {
+        _delay_us( SEEK_RESTART_POLL_US );
+    }
             
     // Set "SEEK" bit on - begins the seek
             
-    set_shadow_reg(REGISTER_02, REG_02_DEFAULT | _BV(REG_02__SEEK) );            
+    set_shadow_reg(REGISTER_02, REG_02_SEEKING | _BV(REG_02__SEEK) );            
     
-    si4702_write_registers( REGISTER_02 );
+    si4702_flush_registers();
+    
+    seek_polls = SEEK_POLLS;
                 
     
 }    
 
 
 /*
- * check_param_crc() -	Check EEPROM_PARAM_SIZE bytes starting at *base,
- *			and return whether the crc (last 2 bytes) is correct
- *			or not.
+ * check_param_crc() -	Read the EEPROM_PARAM_BLOCK_SIZE bytes starting at *base
+ *			into *block, and return whether the crc (last 2 bytes)
+ *			is correct or not.
  *			Return 0 if crc is good, !0 otherwise.
  */
 
-static uint16_t check_param_crc(const uint8_t *base)
+static uint16_t check_param_crc(const uint8_t *base, param_block *block)
 {
-	uint16_t crc = 0x0000;
-	uint8_t i;
-
-	for (i = 0; i < EEPROM_PARAM_BLOCK_SIZE; i++, base++) {
-		crc = _crc16_update(crc, eeprom_read_byte(base));
-	}
+	eeprom_read_block(block, base, EEPROM_PARAM_BLOCK_SIZE);
 
 	/*
 	 * If CRC (last 2 bytes checked) is correct, crc will be 0x0000.
 	 */
-	return crc ;
+	return param_crc(block, EEPROM_PARAM_BLOCK_SIZE);
+}
+
+/*
+ * find_working_param() -	Scan the ring once for the good record with the
+ *				newest sequence number, load it into params and point
+ *				working_param at it.
+ *				Falls back to EEPROM_WORKING if the ring has nothing good.
+ *				Return 0 if we found good params, !0 if everything is corrupt.
+ */
+
+#ifdef TELEMETRY
+
+static uint8_t torn_slots;          // Bit per ring slot find_working_param() found cut short, until blankTornSlots()
+
+// Blank the CRC of each slot find_working_param() found cut short, so from now on it reads as an
+// erased slot (which is expected, not a failure) and the scans on later boots do not count it again.
+// It is the slot the next save goes to anyway. Writes EEPROM, so only call it once a reading has
+// shown Vcc above the cold limit. Until then a torn slot just gets counted again on the next boot.
+
+static void blankTornSlots(void)
+{
+	for (uint8_t i = 0; i < EEPROM_RING_SLOTS; i++) {
+		if (torn_slots & _BV(i)) {
+			eeprom_update_word((uint16_t *)(EEPROM_RING + (i * EEPROM_PARAM_BLOCK_SIZE) + offsetof(param_block, crc16)), 0xffff);
+		}
+	}
+
+	torn_slots = 0;
+}
+
+#endif
+
+static uint8_t find_working_param(void)
+{
+	const uint8_t *slot;
+	const uint8_t *best = 0;            // Ring slots are never at address 0
+	param_block candidate;
+
+	for (slot = EEPROM_RING; slot < EEPROM_RING_END; slot += EEPROM_PARAM_BLOCK_SIZE) {
+
+		if (!check_param_crc(slot, &candidate)) {
+
+			// Good records are always within EEPROM_RING_SLOTS of each other, so signed difference handles wrap
+
+			if (!best || ((int8_t)(candidate.sequence - params.sequence)) > 0) {
+				best = slot;
+				params = candidate;
+			}
+		}
+
+		#ifdef TELEMETRY
+
+			// A save cut short. Count it, and leave it to blankTornSlots() to blank once we know the battery
+			// is good for the write. Nothing here writes EEPROM, we have not even checked Vcc yet.
+
+			else if (candidate.crc16 != 0xffff) {
+				TELEMETRY_COUNT(TELEMETRY_CRC_FAIL);
+				torn_slots |= _BV((slot - EEPROM_RING) / EEPROM_PARAM_BLOCK_SIZE);
+			}
+
+		#endif
+	}
+
+	if (best) {
+		working_param = best;
+		return 0;
+	}
+
+	working_param = EEPROM_WORKING;
+
+	if (check_param_crc(EEPROM_WORKING, &params)) {
+		TELEMETRY_COUNT(TELEMETRY_CRC_FAIL);        // Nothing good anywhere
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * load_vcc_limits() -	Work out the readVcc() values for each of the battery
+ *				thresholds from the bandgap calibration, so the
+ *				checks are all integer compares.
+ */
+
+static uint16_t vcc_bandgap_mv;
+
+static struct {
+	uint16_t cold;
+	uint16_t warm;
+	uint16_t near;
+} vcc_limits;               // Bigger readings are lower Vcc, so a reading above a limit is a low battery
+
+static void load_vcc_limits(void)
+{
+	calibration_block cal;
+
+	eeprom_read_block(&cal, EEPROM_CALIBRATION, sizeof(cal));
+
+	if (cal.check == (uint16_t) ~cal.bandgap_mv && cal.bandgap_mv >= VCC_BANDGAP_MV_MIN && cal.bandgap_mv <= VCC_BANDGAP_MV_MAX) {
+		vcc_bandgap_mv = cal.bandgap_mv;
+	} else {
+		vcc_bandgap_mv = VCC_BANDGAP_MV;
+	}
+
+	vcc_limits.cold = vcc_threshold( vcc_bandgap_mv , VCC_MV( LOW_BATTERY_VOLTAGE_COLD ) );
+	vcc_limits.warm = vcc_threshold( vcc_bandgap_mv , VCC_MV( LOW_BATTERY_VOLTAGE_WARM ) );
+	vcc_limits.near = vcc_threshold( vcc_bandgap_mv , VCC_MV( LOW_BATTERY_VOLTAGE_NEAR ) );
 }
 
 /*
  * copy_factory_param() -	Copy the factory default parameters into the
- *				working param area  simple bulk copy of the
- *				entire 16 bytes. 
+ *				working params by appending them to the ring, following
+ *				on from the newest sequence number. If the factory block
+ *				itself is corrupt we leave things alone so the CRC check
+ *				afterwards still catches it.
  */
 
 static void  copy_factory_param(void)
 {
-	const uint8_t *src = EEPROM_FACTORY;
-	uint8_t *dest = (uint8_t *)(EEPROM_WORKING);
-	uint8_t i;
+	param_block factory;
 
-	for (i = 0; i < EEPROM_PARAM_BLOCK_SIZE; i++, src++, dest++) {
-		eeprom_write_byte(dest, eeprom_read_byte(src));
+	if (check_param_crc(EEPROM_FACTORY, &factory)) {
+		return;
 	}
+
+	find_working_param();           // Only need the newest sequence number and slot, good or not
+
+	factory.sequence = params.sequence;
+
+	params = factory;
+
+	write_working_param();
 }
 
+#ifdef VCCPROG
 
-// Goto bed, will only wake up on button press interrupt (if enabled) or WDT
+#ifdef STATION_TABLE
+static void stationClear(void);
+#endif
+
+/*
+ * jig_store() -	Make a frame from vccprog_receive() the new factory block,
+ *			and put it into the ring so we boot with it too. A channel
+ *			frame only has the channel, so it needs a good factory block
+ *			to take the other settings from. Returns true if the factory
+ *			block reads back good afterwards, which is what the jig's ACK
+ *			promises, and false without storing anything if the settings
+ *			are out of range. A unit set up for another area also forgets
+ *			the old area's stations.
+ */
+
+static uint8_t jig_store(param_block *factory, uint8_t len)
+{
+	param_block check;
+
+	if (len == VCCPROG_CHANNEL_LEN) {
+
+		uint16_t channel = (((uint8_t *)factory)[0] << 8) | ((uint8_t *)factory)[1];
+
+		if (check_param_crc(EEPROM_FACTORY, factory)) {
+			return 0;
+		}
+
+		factory->channel = channel;
+	}
+
+	// A dense frame with a good CRC can still carry settings the chip doesn't have (band 3 is reserved).
+	// Same limits as eeprom.py, and a NAK so the jig doesn't think it worked.
+
+	if (factory->band > 2 || factory->deemphasis > 1 || factory->spacing > 2 || factory->volume > 15) {
+		return 0;
+	}
+
+	factory->sequence = 0;
+	factory->crc16 = param_crc(factory, offsetof(param_block, crc16));
+
+	eeprom_update_block(factory, (void *)EEPROM_FACTORY, EEPROM_PARAM_BLOCK_SIZE);
+
+	copy_factory_param();
+
+	#ifdef STATION_TABLE
+		stationClear();		// Stations from the old area, same as eeprom.py blanking the table
+	#endif
+
+	return !check_param_crc(EEPROM_FACTORY, &check) && check.crc16 == factory->crc16;
+}
+
+/*
+ * jig_program() -	If Vcc is up at 5V we are on the one-touch jig, so listen for
+ *			frames (see VccProg.h) and answer each one. We keep listening
+ *			after a NAK, so the jig can send again, and stop after the
+ *			first ACK. Nothing changes if no good frame comes in before
+ *			the receiver gives up.
+ */
+
+static void jig_program(void)
+{
+	param_block factory;
+	uint8_t len;
+
+	adc_on();
+
+	if (!VCC_LESS_THAN( VCCPROG_VOLTAGE )) {
+
+		while ((len = vccprog_receive( (uint8_t *)&factory ))) {
+
+			uint8_t ok = jig_store(&factory, len);
+
+			vccprog_answer( ok );
+
+			if (ok) {
+				break;
+			}
+		}
+	}
+
+	adc_off();
+}
+
+#endif
 
-static void deepSleep(void) {
-	set_sleep_mode( SLEEP_MODE_PWR_DOWN );
-    sleep_enable();
-    sleep_cpu();        // Good night    
-}  
 
+// Set when the WDT times out, so we can tell a full sleep from one that the button cut short.
 
-// Don't do anything, just the interrupt itself will wake us up
-// TODO: If we ever need more code space, this could be replaced by an IRET in the VECTOR table. 
+static volatile uint8_t wdt_fired;
 
-EMPTY_INTERRUPT( WDT_vect );
+// Set on pin change interrupt, so we can tell a button wake from an LED engine tick. 
+
+static volatile uint8_t pin_changed;
+
+ISR( WDT_vect ) {
+    wdt_fired = 1;
+}
 
 #define HOWLONG_16MS   (_BV(WDIE) )
 #define HOWLONG_32MS   (_BV(WDIE) | _BV( WDP0) )
@@ -475,25 +830,138 @@ EMPTY_INTERRUPT( WDT_vect );
 #define HOWLONG_4S     (_BV(WDIE) | _BV( WDP3) )
 #define HOWLONG_8S     (_BV(WDIE) | _BV( WDP3) | _BV( WDP0) )
 
+/*
+ * Sleep based timer service.
+ *
+ * Everything that needs to wait does it in power down with only the WDT running, so waiting costs
+ * microamps rather than the milliamps of a _delay_ms() spin. The WDT timeouts are 16ms << n, so time
+ * is counted in 16ms ticks.
+ *
+ *  - sleepFor() sleeps up to one WDT timeout, but returns early on any other interrupt (button).
+ *  - sleepMs() always sleeps at least the requested time.
+ *  - timerAfter() schedules a single callback to run once enough sleep has elapsed. Any sleep will be
+ *    cut short as needed so the callback runs on time, so the caller can get on with other things.
+ */
+
+#define TIMER_TICK_MS       (16)
+#define TIMER_TICKS(ms)     ( ((ms) + TIMER_TICK_MS - 1) / TIMER_TICK_MS )      // Round up so we never wait less than asked
+
+// The WDT prescaler n is split between WDP3 and WDP2:0
+
+static uint8_t howlongFromShift( uint8_t n ) {
+    return _BV(WDIE) | ( n & 0x07 ) | ( (n & 0x08) ? _BV(WDP3) : 0 );
+}
+
+static uint8_t shiftFromHowlong( uint8_t howlong ) {
+    return ( howlong & 0x07 ) | ( (howlong & _BV(WDP3)) ? 0x08 : 0 );
+}
+
+// Largest timeout n where 16ms << n fits in the specified number of ticks
+
+static uint8_t shiftForTicks( uint16_t ticks ) {
+    uint8_t n=0;
+    while ( n < 9 && (2U << n) <= ticks ) {
+        n++;
+    }
+    return n;
+}
+
+static void (*timer_callback)(void);        // NULL when nothing scheduled
+static uint16_t timer_callback_ticks;       // Ticks of sleep left before we call timer_callback
+
+// Call the specified function after ms (rounded up to the next 16ms tick) of sleep has elapsed.
+// Only one callback can be pending, a new one replaces the old one.
+
+static void timerAfter( uint16_t ms , void (*callback)(void) ) {
+    timer_callback_ticks = TIMER_TICKS( ms );
+    timer_callback = callback;
+}
+
+static void timerElapsed( uint16_t ticks ) {
+    
+    if (timer_callback) {
+        
+        if ( timer_callback_ticks <= ticks ) {
+        
+            void (*callback)(void) = timer_callback;
+            timer_callback = 0;                  // Clear first so the callback can schedule another
+            callback();
+            
+        } else {
+            
+            timer_callback_ticks -= ticks;
+            
+        }            
+    }
+}    
+
+
 // Goto sleep - get woken up by the watchdog timer or other interrupt like button
 // This is very power efficient since chip is stopped except for WDT
 // Note that if the timer was on entering here that it will stay on, so LED will still stay lit.
+// If a timer callback is due before howlong, then we sleep only until it is due.
+// Returns the number of 16ms ticks slept, or 0 if something other than the WDT woke us.
 
-static void sleepFor( uint8_t howlong ) {
+static uint16_t sleepFor( uint8_t howlong ) {
+    
+    uint8_t shift = shiftFromHowlong( howlong );
+    
+    if (timer_callback) {
+        
+        uint8_t limit = shiftForTicks( timer_callback_ticks );
+        
+        if (limit < shift) {
+            shift = limit;
+        }
+    }
+    
+    wdt_fired = 0;
+    pin_changed = 0;
     
     wdt_reset();
-    WDTCR =   howlong;              // Enable WDT Interrupt  (WDIE and timeout bits all included in the howlong values)
+    WDTCR =   howlongFromShift( shift );    // Enable WDT Interrupt  (WDIE and timeout bits all included in the howlong values)
+    
+    PROFILE_SLEEP_BEGIN();
     
     sei();
-    deepSleep();
+    do {
+        power_sleep();              // Power down, or idle if the LED engine needs Timer1. The LED engine also wakes us every ~8ms then.
+    } while ( !wdt_fired && !pin_changed );     // Only the LED engine woke us, back to sleep 
     cli();
     
     WDTCR = 0;                      // Turn off the WDT interrupt (no special sequence needed here)
                                     // (assigning all bits to zero is 1 instruction and we don't care about the other bits getting clobbered
     
+    if (!wdt_fired) {
+        PROFILE_SLEEP_END( 0 );     // Woke early, no way to tell how long we slept
+        return 0;
+    }
+    
+    uint16_t ticks = 1U << shift;
+    
+    PROFILE_SLEEP_END( ticks );
+    
+    timerElapsed( ticks );
+    
+    return ticks;
 }    
 
 
+// Sleep for at least ms milliseconds (rounded up to the next 16ms tick).
+// Other interrupts will not cut this short,  we just go back to sleep for the rest of the time.
+
+static void sleepMs( uint16_t ms ) {
+    
+    uint16_t ticks = TIMER_TICKS( ms );
+    
+    while (ticks) {
+        
+        ticks -= sleepFor( howlongFromShift( shiftForTicks( ticks ) ) );      // Never more than we asked for
+        
+    }
+}
+
+
 static void si4702_init(void)
 {
 	/*
@@ -531,6 +999,15 @@ static void si4702_init(void)
     // Enable the pull-ups on the TWI lines
 
 	USI_TWI_Master_Initialise();
+
+    // The chip just came out of reset, so forget anything the shadow remembers from a previous run
+    // or the dirty tracking would think registers are already set. Starting from all zeros means the
+    // first flush below writes exactly what it always did.
+
+    for( uint8_t i=REGISTER_02; i<=REGISTER_07+1 ; i++ ) {
+        shadow[i] = 0;
+    }
+    shadow_dirty_end = 0;
 	
     // Reg 0x07 bit 15 - Crystal Oscillator Enable.
     // 0 = Disable (default).
@@ -547,7 +1024,7 @@ static void si4702_init(void)
 
 	set_shadow_reg(REGISTER_07, 0x8100 );
 
-	si4702_write_registers(REGISTER_07);
+	si4702_flush_registers();
     
     /*
 
@@ -559,14 +1036,16 @@ static void si4702_init(void)
     
     // UPDATE 11-5-2017: Some units powering up with static in production, so increasing this from 500ms to 600ms
     // and also increasing powerup time in enable from 200ms to 350ms to try and get a margin past the problem.
-    // TODO: Walk this back once problem cured to see if this delay was relevant. 
+    
+    // There is no status bit for the oscillator, so this one has to stay a fixed wait. We sleep though it
+    // rather than spin, so keeping the production margin costs no power.
 
-	_delay_ms(600);
+    sleepMs( 600 );
     
 }
 
 // We break out init() and enable() into different functions so we can check the battery voltage 
-// After the 550ms delay after startup.     
+// After the 600ms delay after startup.     
     
 static void si4702_enable(void) {
     
@@ -588,21 +1067,21 @@ static void si4702_enable(void) {
 
     // OK, CLICK DEFINATELY HAPPENS ON THIS ENABLE ACTION!!!!
 
-	si4702_write_registers( REGISTER_02 );
+	si4702_flush_registers();
 
        
 	/*
 	 * Set radio params based on eeprom...
 	 */
     
-	set_shadow_reg(REGISTER_04, (eeprom_read_byte(EEPROM_DEEMPHASIS) ? _BV( REG_04_DE_BIT ) : 0x0000));
+	set_shadow_reg(REGISTER_04, (params.deemphasis ? _BV( REG_04_DE_BIT ) : 0x0000));
     
     // TODO: These ANDs can go if we ever need room - if these bytes are not 0 padded correctly then something is very wrong. 
 
 	set_shadow_reg(REGISTER_05,
-			(((uint16_t)(eeprom_read_byte(EEPROM_BAND) & 0x03)) << 6) |
-			(((uint16_t)(eeprom_read_byte(EEPROM_SPACING) & 0x03)) << 4) |
-            (((uint16_t)(eeprom_read_byte(EEPROM_VOLUME) & 0x0f)))           
+			(((uint16_t)(params.band & 0x03)) << 6) |
+			(((uint16_t)(params.spacing & 0x03)) << 4) |
+            (((uint16_t)(params.volume & 0x0f)))           
     );
 
     
@@ -622,7 +1101,7 @@ static void si4702_enable(void) {
     // Note that this write looks like it must come before the tune.
     // If we try to batch them into one write then we get no audio. Hmmm. 
     
-	si4702_write_registers( REGISTER_06 );
+	si4702_flush_registers();
 
 
     /*    
@@ -642,16 +1121,80 @@ static void si4702_enable(void) {
     // 200ms next guess, seems to cure problem on unit tested. 
     // UPDATE 11-7-2017:  Maybe 200ms not enough either. Some units in production are still powering up to
     // static so upping this form 200ms to 350ms, and osc delay from 500ms to 600ms. 
-    // TODO: Maybe try polling the chip to see exactly when it wakes up to shorten this?
+    
+    // Now we don't wait here at all. si4702_tune() polls STC, which only comes up once the chip is really
+    // running, so we find out exactly when it wakes up and also catch the units that would have come up on static.
+    
+}
+
+
+// Worst case time to wait for a tune is SI4702_STC_POLLS * 16ms per try, times SI4702_TUNE_TRIES tries.
+// Powerup from ENABLE is 110ms max and a tune is 60ms max, so one try is normally plenty.
+
+#define SI4702_STC_POLLS    (16)        // ~250ms
+#define SI4702_TUNE_TRIES   (4)         // ~1s total before we give up and unmute anyway
+
+// Sleep until the chip reports Seek/Tune Complete in register 0x0A, checking every howlong up to polls times.
+// Returns true if STC came up, false if we timed out.
+
+static uint8_t si4702_wait_stc( uint8_t polls , uint8_t howlong ) {
+    
+    while (polls--) {
+        
+        sleepFor( howlong );
         
-    _delay_ms(350); 
+        // STC is all we need, so keep the poll short. A failed read just counts as another poll.
+        
+        if ( !si4702_read_registers_upto( REGISTER_0A ) && (get_shadow_reg(REGISTER_0A) & _BV( REG_0A_STC_BIT )) ) {
+            return 1;
+        }
+    }
     
+    return 0;
+}
+
+// Check on the seek from seekNext(), if it has not finished yet. Once STC is up (or we have run out of
+// polls and given up on it) clear SEEK and unmute in one write, so the audio comes back on the station it landed on.
+// Call every SEEK_POLL_HOWLONG while seek_polls is set.
+
+static void seekPoll(void) {
+    
+    if (!seek_polls) {
+        return;
+    }
+    
+    // Same short poll as si4702_wait_stc(). A failed read just counts as another poll.
+    
+    if ( (!si4702_read_registers_upto( REGISTER_0A ) && (get_shadow_reg(REGISTER_0A) & _BV( REG_0A_STC_BIT ))) || !--seek_polls ) {
+    
+        seek_polls = 0;
+    
+        set_shadow_reg(REGISTER_02, REG_02_DEFAULT );
+        
+        si4702_flush_registers();
+        
+    }
+}
+
+// Sleep until the seek from seekNext() is done, if there is one running.
+// Returns true if the last status we read had STC up, so false if the seek timed out.
+
+static uint8_t seekFinish(void) {
+    
+    while (seek_polls) {
+        
+        sleepFor( SEEK_POLL_HOWLONG );
+        
+        seekPoll();
+    }
+    
+    return (get_shadow_reg(REGISTER_0A) & _BV( REG_0A_STC_BIT )) != 0;
 }
 
 /*
  * tune_direct() -	Directly tune to the specified channel.
  * Assumes chan < 0x01ff
- * Unneeded in current embodiment since we only use seek to change channels after startup
+ * Used at startup. Doubles as our readiness check, since the tune only completes once the chip is actually up.
  
  */
 
@@ -660,10 +1203,35 @@ static void si4702_tune(uint16_t chan)   {
     
     //uint16_t chan = 0x0040;                                  // test with z100.
     //uint16_t chan = 0x0044;                                  // Test with  - cbs 101 fm
+    
+    /*
+        The tune operation begins when the TUNE bit is set high. The STC bit is set high
+        when the tune operation completes. The STC bit must be set low by setting the TUNE
+        bit low before the next tune or seek may begin.
+    */
+    
+    PROFILE_BEGIN( PROFILE_TUNE );
+    
+    uint8_t tries = SI4702_TUNE_TRIES;
+    
+    do {
           
-	set_shadow_reg(REGISTER_03, 0x8000 |  chan );
+        set_shadow_reg(REGISTER_03, 0x8000 |  chan );
 
-	si4702_write_registers( REGISTER_03 );
+        si4702_flush_registers();
+        
+        if (si4702_wait_stc( SI4702_STC_POLLS , HOWLONG_16MS )) {
+            break;
+        }
+        
+        // No STC, so the chip was probably still powering up and dropped the tune on the floor.
+        // Clear TUNE so the next set is a real edge and try again.
+        
+        set_shadow_reg(REGISTER_03,  chan );
+        
+        si4702_flush_registers();
+        
+    } while (--tries);
     
     // Ok, we should be all set up and tuned here, but still muted. 
            
@@ -671,23 +1239,155 @@ static void si4702_tune(uint16_t chan)   {
     
     set_shadow_reg(REGISTER_02,  REG_02_DEFAULT );       
     
-    si4702_write_registers( REGISTER_02 );
-
     // TODO: Play with this more. Can we get rid of the click here?    
 
-    /*
-        The tune operation begins when the TUNE bit is set high. The STC bit is set high
-        when the tune operation completes. The STC bit must be set low by setting the TUNE
-        bit low before the next tune or seek may begin.
-    */
-
     // Clear the tune bit here so chip will be ready to tune again if user presses the button.
+    // Since the write has to cover 0x02 anyway, the unmute above goes out in this same transaction.
 	set_shadow_reg(REGISTER_03,  chan );
 	
-	si4702_write_registers( REGISTER_03 );
+	si4702_flush_registers();
+    
+    PROFILE_END( PROFILE_TUNE );
+        
+}
+
+
+// Put the FM_IC into its own powerdown mode without dropping RESET.
+// XOSCEN is still set in 0x07 so the crystal keeps running, and the chip keeps its registers, so
+// si4702_resume() can bring it back without going through si4702_init() again.
+
+static void si4702_powerdown(void) {
+    
+    si4702_read_registers_upto( REGISTER_0B );      // Remember where we are tuned, including any seeks since the last save
+
+    set_shadow_reg(REGISTER_02, _BV( REG_02_ENABLE_BIT ) | _BV( REG_02_DISABLE_BIT ) );   // Also mutes and aborts any seek
+
+    si4702_flush_registers();
+    
+    seek_polls = 0;         // si4702_resume() unmutes
+    
+}
+
+// Bring the FM_IC back up after si4702_powerdown() and retune to where it was.
+// Same order as si4702_enable(), but the config comes straight from the shadow. We rewrite 0x03-0x06
+// even though they should have been kept, since it is only a few more bytes and we'd rather be sure.
+
+static void si4702_resume(void) {
+    
+    uint16_t chan = currentSeekChanFromShadow();      // Read just before the powerdown
+    
+    set_shadow_reg(REGISTER_02,  _BV( REG_02_ENABLE_BIT ) );    // Clear DISABLE, still muted
+
+	si4702_flush_registers();
+    
+    shadow_dirty_end = REGISTER_06 + 2;
+    
+	si4702_flush_registers();
+    
+    si4702_tune( chan );        // Polls STC, so also waits out the powerup time, then unmutes
+    
+}    
+
+
+#ifdef STATION_TABLE
+
+// Forget the scanned stations, so the next short press scans again. Used by factory reset.
+
+static void stationClear(void) {
+    
+    eeprom_update_byte( &EEPROM_STATIONS->count , 0xff );
+    
+}    
+
+// Scan the band once from the bottom up with the hardware seek and save every station it stops on.
+// The seek uses SEEK_RSSI_THRESHOLD and the SNR/impulse thresholds from 0x06, so we only keep what a seek would have stopped on.
+// Each seek is muted until it lands, so you hear each station briefly as the scan passes it, which is also how the user knows something is happening.
+// Returns the number of stations found. Leaves the chip on the bottom one, where the last seek wrapped around to.
+
+static uint8_t stationScan(void) {
+    
+    uint8_t count = 0;
+    uint16_t last = 0;
+    
+    uint16_t reg05 = get_shadow_reg(REGISTER_05);
+    
+    set_shadow_reg(REGISTER_05, reg05 | (SEEK_RSSI_THRESHOLD << 8) );       // SEEKTH lives in the top byte, goes out with the tune
+    
+    si4702_tune( 0 );               // Start at the bottom of the band
+    
+    while (count < STATION_TABLE_SIZE) {
+        
+        seekNext();
+        
+        if (!seekFinish()) {
+            break;                  // Something is wrong, keep what we have
+        }
+        
+        if (get_shadow_reg(REGISTER_0A) & _BV( REG_0A_SFBL_BIT )) {
+            break;                  // Seek fail, there is nothing on the whole band
+        }
+        
+        si4702_read_registers_upto( REGISTER_0B );
+        
+        uint16_t chan = currentSeekChanFromShadow();
+        
+        if (count && chan <= last) {
+            break;                  // Seek wrapped past the top of the band, so we have them all
+        }
+        
+        eeprom_update_word( &EEPROM_STATIONS->chan[count] , chan );
+        
+        last = chan;
+        count++;
+        
+    }
+    
+    eeprom_update_byte( &EEPROM_STATIONS->count , count );
+    
+    set_shadow_reg(REGISTER_05, reg05 );                    // seekFinish() already cleared SEEK
+    
+    si4702_flush_registers();
+    
+    return count;
+    
+}    
+
+// Step to the next station in the table above the one we are on, wrapping around at the top.
+// Scans first if there is no table yet.
+
+static void stationNext(void) {
+    
+    uint16_t chan = get_shadow_reg(REGISTER_03) & 0x03ff;      // Last channel we tuned. We only ever tune when we have a table.
+    
+    uint8_t count = eeprom_read_byte( &EEPROM_STATIONS->count );
+    
+    if (count == 0 || count > STATION_TABLE_SIZE) {
+        
+        count = stationScan();
         
-}
+        if (!count) {
+            si4702_tune( chan );        // Nothing out there, go back to where we were
+            return;
+        }
+    }
+    
+    uint16_t next = eeprom_read_word( &EEPROM_STATIONS->chan[0] );     // Wrap to the bottom if nothing is above us
+    
+    for( uint8_t i=0; i<count; i++ ) {
+        
+        uint16_t c = eeprom_read_word( &EEPROM_STATIONS->chan[i] );
+        
+        if (c > chan) {
+            next = c;
+            break;
+        }
+    }
+    
+    si4702_tune( next );
+    
+}    
 
+#endif
 
 /*
 
@@ -697,13 +1397,13 @@ Old tunedirect()
 
 	set_shadow_reg(REGISTER_03, 0x8000 | chan );
 
-	si4702_write_registers( REGISTER_03 );
+	si4702_flush_registers();
 	_delay_ms(160);
 
     
     // Clear the tune bit here so chip will be ready to tune again if user presses the button.
 	set_shadow_reg(REGISTER_03,  chan );
-	si4702_write_registers( REGISTER_03 );
+	si4702_flush_registers();
 }
 
 */
@@ -712,7 +1412,7 @@ Old tunedirect()
 
 static void longBlink(void) {
     LED_on();
-    _delay_ms(1000);
+    sleepMs(1000);
     LED_off();
 }    
 
@@ -724,13 +1424,14 @@ static inline uint8_t buttonDown(void) {
 
  
 // Called on button press pin change interrupt
-// Do nothing in ISR, just here so we can catch the interrupt and wake form deep sleep
+// Do (almost) nothing in ISR, just here so we can catch the interrupt and wake form deep sleep
 // ISRs are ugly semantics with volatile access and stuff, simpler to handle in main thread. 
+// We do need to flag that it happened, since the LED engine can also wake us from idle sleep.
 
-// TODO: If we ever need more code space, this could be replaced by an IRET in the VECTOR table. 
 
-
-EMPTY_INTERRUPT( PCINT0_vect ); 
+ISR( PCINT0_vect ) {
+    pin_changed = 1;
+}
 
 
 // Setup pin change interrupt on button 
@@ -770,61 +1471,202 @@ static uint8_t initButton(void)
 
 
 
-// Assumes button is actually down and LED_Timer is on
-// Always waits for the debounced up before returning
-// Call from main assumes that LED will be off when this returns
+// Sleep until the button is up. The release wakes us right away, so the WDT timeout only sets how
+// often we check on a button held down for good.
+// Note that we are not checking for low battery voltage here. This means that a malicious user could
+// hold down the button for a few years and cause the battery to blister. Might need to add a warning sticker
+// above button saying "HOLDING BUTTON DOWN FOR MORE THAN 1 YEAR MAY CCAUSE BATTERY DAMAGE"
+// At least we are asleep while they do it. 
 
-static void handleButtonDown(void) {
+static void buttonWaitUp(void) {
     
-    LED_off();                    // Led off when button goes down. Gives feedback if we are currently breathing otherwise benign
+    while (buttonDown()) {
+        sleepFor( HOWLONG_8S );
+    }
+}
+
+// Sleep while the button stays down, up to ms (rounded up to the next 16ms tick).
+// Returns true if it was still down the whole time.
+// Each sleep runs right up to the time left, and only the release (or the LED timer) wakes us before that,
+// so a hold costs a handful of wakes rather than one every tick. A bounce that wakes us early with the
+// button still down loses the rest of that sleep, so a bouncy press can come out a little longer than it was.
+
+static uint8_t buttonHeld( uint16_t ms ) {
     
-    _delay_ms( BUTTON_DEBOUNCE_MS );        // Debounce down
-        
-    uint16_t countdown = LONG_PRESS_MS;
+    uint16_t ticks = TIMER_TICKS( ms );
     
-    while (countdown && buttonDown()) {       // Spin until either long press timeout or they let go
-        _delay_ms(1);          
-        countdown--;
-    }        
+    while (ticks && buttonDown()) {
+        ticks -= sleepFor( howlongFromShift( shiftForTicks( ticks ) ) );      // Never more than is left
+    }
     
-    if (countdown) {                            // Did not timeout, so short press
-        
-        // Advance to next station
-        
-        // quick blink the LED to let the user know they did something 
+    return buttonDown();
+}
 
-        LED_on();
-        _delay_ms(150);
-        LED_off();
+// Sleep while the button stays up, up to ms (rounded up to the next 16ms tick).
+// Returns true if it went down in that time. The press wakes us right away.
+
+static uint8_t buttonPressedWithin( uint16_t ms ) {
+    
+    uint16_t ticks = TIMER_TICKS( ms );
+    
+    while (ticks && !buttonDown()) {
+        ticks -= sleepFor( howlongFromShift( shiftForTicks( ticks ) ) );      // Never more than is left
+    }
+    
+    return buttonDown();
+}
+
+typedef enum {
+    PRESS_SHORT,            // Let go before LONG_PRESS_MS
+    PRESS_LONG,             // Let go between LONG_PRESS_MS and VERY_LONG_PRESS_MS
+    PRESS_VERY_LONG,        // Held VERY_LONG_PRESS_MS or more
+} button_press;
+
+// Time a press from the moment it goes down to the release, asleep between edges.
+// The LED tells the user when they can let go: a long flash when it becomes a long press, then on solid
+// once it is a very long one. Returns on the release, before the debounce, so a short press can act at once.
+
+static button_press buttonGesture(void) {
+    
+    sleepMs( BUTTON_DEBOUNCE_MS );        // Debounce down
+    
+    if (!buttonHeld( LONG_PRESS_MS )) {
+        return PRESS_SHORT;
+    }
+    
+    LED_on();
+    timerAfter( 500 , LED_off );
+    
+    if (!buttonHeld( VERY_LONG_PRESS_MS - LONG_PRESS_MS )) {
+        return PRESS_LONG;
+    }
+    
+    LED_on();
+    
+    buttonWaitUp();
+    
+    LED_off();
+    
+    return PRESS_VERY_LONG;
+}
+
+// A very long press only asks for a factory reset. Flash the LED RESET_FLASH_MS on and off for up to
+// RESET_CONFIRM_MS while we wait for a long press to confirm it, asleep between flashes.
+// Returns true once the confirming press gets long enough, with the LED on solid until the release.
+// A short press, or no press in time, cancels it and returns false with the LED off.
+// Always returns with the button up, before the debounce.
+
+static uint8_t factoryResetConfirmed(void) {
+    
+    sleepMs( BUTTON_DEBOUNCE_MS );        // Debounce the up of the request, or a bounce could count as the answer
+    
+    uint8_t on = 1;
+    
+    for( uint8_t flashes = RESET_CONFIRM_MS / RESET_FLASH_MS; flashes; flashes-- ) {
         
-        seekNext();
-                                
-        // TODO: test this wrap (lots of button presses, so start high!)
+        if (on) {
+            LED_on();
+        } else {
+            LED_off();
+        }
         
+        on = !on;
         
-    } else {            // Initiated a long-press save to EEPROM            
+        if (buttonPressedWithin( RESET_FLASH_MS )) {
+            
+            LED_off();
+            
+            sleepMs( BUTTON_DEBOUNCE_MS );        // Debounce down
+            
+            if (!buttonHeld( LONG_PRESS_MS )) {
+                return 0;                         // Short press, cancel
+            }
+            
+            LED_on();
+            
+            buttonWaitUp();
+            
+            return 1;
+        }
+    }
+    
+    LED_off();
+    
+    return 0;                                     // Timed out
+}
+
+// Go back to the factory block, the same as holding the button at power up. Leaves params on it.
+
+static void factoryReset(void) {
+    
+    copy_factory_param();       // Revert to initial config
+    
+    #ifdef STATION_TABLE
+        stationClear();         // Maybe we moved, so scan again on the next press
+    #endif
+    
+    longBlink();
+}
 
-        // When we get here, the button has been down for LONG_PRESS_MS and is still down
+// Assumes button is actually down and LED_Timer is on
+// Always waits for the debounced up before returning
+// Call from main assumes that LED will be off when this returns
 
-        // User feedback of long press with long flash on LED
+static void handleButtonDown(void) {
+    
+    led_pwm_off();                // Led off when button goes down. Gives feedback if we are currently breathing otherwise benign
+    
+    switch (buttonGesture()) {
         
-        LED_on();        
-                            
-        updateToCurrentChannel();      // TODO: This no longer works with seek rather than step.
-                      
-        _delay_ms(500);
+        case PRESS_SHORT:
+        
+            // Advance to next station
+            
+            // quick blink the LED to let the user know they did something 
+            // The timer turns it back off, so we do not have to wait around before starting the seek
 
-        LED_off();            
-                
-                
-        while (buttonDown());           // Wait for them to finally release the button- hopefully after seeing the confirmation long blink
-                                        // Note that we are not checking for low battery voltage here. This means that a malicious user could
-                                        // hold down the button for a few years and cause the battery to blister. Might need to add a warning sticker
-                                        // above button saying "HOLDING BUTTON DOWN FOR MORE THAN 1 YEAR MAY CCAUSE BATTERY DAMAGE"
-                           
+            LED_on();
+            timerAfter( 150 , LED_off );
+            
+            TELEMETRY_COUNT( TELEMETRY_SEEK );
+            
+            #ifdef STATION_TABLE
+                stationNext();
+            #else
+                seekNext();
+            #endif
+                                    
+            // TODO: test this wrap (lots of button presses, so start high!)
+            
+            break;
+            
+        case PRESS_LONG:            // Save to EEPROM. The LED already flashed when it got long enough.
+        
+            updateToCurrentChannel();      // Lets any seek from the last press land first
+            
+            TELEMETRY_SAVE();              // Writing EEPROM anyway, so this is a good time
+            
+            break;
+            
+        case PRESS_VERY_LONG:       // Only a request. Nothing happens unless a long press confirms it.
+        
+            if (!factoryResetConfirmed()) {
+                break;
+            }
+            
+            seekFinish();                   // A tune can not start while a seek is still going
+        
+            factoryReset();
+            
+            // Band, spacing and deemphasis from the factory block only take effect at the next power up.
+            // Every unit ships with the same ones it was programmed with, so in practice this is the whole reset.
+            
+            si4702_tune( params.channel );
+            
+            break;
     }    
 
-    _delay_ms( BUTTON_DEBOUNCE_MS );        // Debounce the most recent up
+    sleepMs( BUTTON_DEBOUNCE_MS );        // Debounce the most recent up
         
 }
 
@@ -837,25 +1679,18 @@ static void badEEPROMBlink(void) {
 
     // No need to disable FMIC and AMP becuase we didn't turn them on before the eeprom check 
       
-    // No need to turn off adc since it was not enabled yet
+    // No need to turn off adc, main() only has it on for the one telemetry reading
+    
+    led_pwm_blink( DIAGNOSTIC_BLINK_BADEEPROM , LED_BADEEPROM_DUTY );        // LED engine does the blinking, we just sleep
        
     uint8_t blinkCountDown= DIAGNOSTIC_BLINK_TIMEOUT_S;
     
-    while (blinkCountDown-- ) {          // Still blinking? Also, a button press will abort the blink cycle
-
-        for( uint8_t c=3; c ; c--) {                // 3 blinks
-            LED_on(); 
-            sleepFor( HOWLONG_16MS);
-            LED_off();
-            sleepFor( HOWLONG_500MS );                // Space between blinks
-        }        
-        
-        sleepFor( HOWLONG_2S );                // Space between blinks
-        
+    while (blinkCountDown-- ) {          // Still blinking?
+        sleepMs( 1000 );
     }
-
+    
     // Interrupts are off, so this is forevah    
-    deepSleep();
+    power_off();
     // Never get here
     
 }    
@@ -869,62 +1704,76 @@ static void badEEPROMBlink(void) {
 // se the FM_IC will reset when we do a battery change. 
 
 // It would be nice if pushing the button would just wake up back up, 
-// but the FM_IC seems to need a full power cycle for that to work. 
+// but the FM_IC seems to need a full power cycle for that to work once RESET has been low.
+// That is why a low battery while playing goes to lowBatteryStandby() first, which never drops RESET.
+
+// Blink the low battery warning for up to DIAGNOSTIC_BLINK_TIMEOUT_S.
+// Returns true if the user cut it short with a button press.
+
+static uint8_t lowBatteryBlink(void) {
+    
+    uint8_t blinkCountDown= DIAGNOSTIC_BLINK_TIMEOUT_S;
+        
+    // Note that here we run the blink at full duty cycle. 
+    // This is so we can get maximum brightness when the battery voltage is low.
+        
+    led_pwm_blink( DIAGNOSTIC_BLINK_LOWBATTERY , LED_PWM_FULL );          // Very quick blink LED twice, every second
+    
+    while ( blinkCountDown &&  !buttonDown() ) {          // Still blinking? Also, a button press will abort the blink cycle
+        
+        blinkCountDown--;
+        
+        sleepFor( HOWLONG_1S );             // LED engine is doing the work. A button press wakes us right away. 
+        
+    }
+        
+    led_pwm_off();
+    
+    return blinkCountDown;
+    
+}
+
+// Burn about 50uA forever to run down the decoupling caps (see above)
+
+static void lowBatteryDrain(void) {
+    
+    while (1) {
+        _delay_ms(10); // Burn power. Ouch this hurts. 
+                       // This one is on purpose - it is what runs down the decoupling caps, so do not sleep it away.
+        sleepFor( HOWLONG_125MS );
+    }
+    
+}
 
 static void lowBatteryShutdown(void) {
     
-    LED_off();        // Turn off PWM, we will directly drive the LED from the pin output
+    led_pwm_off();    // Stop whatever the LED was doing. Also powers down Timer1 until we need it for the blink.
     
     
-    // Shutdown all peripherals so save power in deep sleep
-    // Before 4uA
-    // After 4uA
-    // Most of this draw is likely from the amp and FM_IC in shutdown modes
-    PRR = _BV( PRTIM1 ) | _BV( PRTIM0) | _BV( PRUSI ) | _BV(PRADC ); 
+    // Shutdown all peripherals so save power in deep sleep (see Power.h)
+    // Most of what is left is likely from the amp and FM_IC in shutdown modes
+    // Timer1 is left to the LED engine, which powers it down whenever it is not blinking.
+    power_down();
     
     
     while (1) { 
         
                 
          
-        // TODO: Test how much current actually used here. Can we lower it with peripheral power control register?
         // TODO: Add a MOSFET so we can completely shut them off (they still pull about 25uA in reset)?
     
         // Turn on interrupts. This will enable wake on button press
         // which gives uses a way to not have to wait for us to completely run down the
         // decoupling caps
     
-        uint8_t blinkCountDown= DIAGNOSTIC_BLINK_TIMEOUT_S;
-    
-        while ( blinkCountDown-- &&  !buttonDown() ) {          // Still blinking? Also, a button press will abort the blink cycle
-        
-            // Note that here we directly turn the LED on and off using the pin rather than using
-            // PWM. This is so we can get maximum brightness when the battery voltage is low.
-        
-            // Very quick blink LED twice
-            SBI( PORTB , LED_DRIVE_BIT );
-            sleepFor( HOWLONG_16MS);
-            CBI( PORTB , LED_DRIVE_BIT );
-            
-            _delay_ms(250);                             // Space between blinks. Waste power. 
-            //sleepFor( HOWLONG_250MS );                // Space between blinks
-            SBI( PORTB , LED_DRIVE_BIT );
-            sleepFor( HOWLONG_16MS);
-            CBI( PORTB , LED_DRIVE_BIT );
-            sleepFor( HOWLONG_1S );                // Space between blinks
-        
-        }
-        
+        lowBatteryBlink();
         
-        while (1) {
-            _delay_ms(10); // Burn power. Ouch this hurts. 
-            sleepFor( HOWLONG_125MS );
-        }
+        lowBatteryDrain();
         
 
         /*    
         sei();          // Enable interrupts. This will wake us if the user presses the button to signal they replaced the battery.    
-        deepSleep();
+        power_sleep();
         cli(); 
     
         // Spin and blink while the button is down. We do this for a couple reasons.
@@ -981,17 +1830,66 @@ static void lowBatteryShutdown(void) {
 }
 
 
+// Warm standby for when the battery sags under load while we are playing.
+// Dropping RESET would mean a full cold boot with the 600ms crystal wait to get back, so instead we put just the
+// FM_IC into powerdown and blink the low battery warning. If the user presses the button and the battery has bounced
+// back above the cold start voltage, we power the FM_IC back up from the shadow registers and return to playing.
+// Otherwise the battery really is dead, so we do the full shutdown and the next battery gets a cold boot.
+// The amp shares the RESET line, so it stays powered (but silent) in standby. That is why we only wait here
+// as long as the blink lasts.
+
+static void lowBatteryStandby(void) {
+    
+    led_pwm_off();
+    
+    si4702_powerdown();
+    
+    power_down();               // Same as lowBatteryShutdown()
+    
+    if (lowBatteryBlink()) {
+        
+        power_up();             // Need these back to talk to the FM_IC
+        
+        adc_on();
+        
+        uint8_t cold_low = readVcc() > vcc_limits.cold;
+        
+        adc_off();
+        
+        if (!cold_low) {
+            
+            buttonWaitUp();                 // Or run() would take this press as a seek
+            
+            sleepMs( BUTTON_DEBOUNCE_MS );
+            
+            si4702_resume();
+            
+            return;
+        }
+        
+    }        
+    
+    // Disable FMIC and AMP
+    CBI( PORTB , FMIC_RESET_BIT);    // drive reset low, makes them sleep. DDR is set output on start-up and never changed.
+    
+    power_down();                   // In case we turned them back on for the battery check
+    
+    lowBatteryDrain();              // Already blinked, so straight to running down the caps. Never returns.
+    
+}
+
+
 static void debugBlinkDigit(uint8_t c) {
     
     while (c--) {
         
         LED_on();
-        _delay_ms(200);
+        sleepMs(200);
         LED_off();
-        _delay_ms(200);
+        sleepMs(200);
     }
     
-    _delay_ms(400);     // Break between high and low digits
+    sleepMs(400);     // Break between high and low digits
     
         
 }    
@@ -1002,7 +1900,11 @@ static void debugBlinkDigit(uint8_t c) {
 static void __attribute__ ((unused)) debugBlinkVoltage(void) {
     
     
-    uint8_t Vcc = ADC2VCC( readADC() ) * 10.0;        // Vcc now *10, so 30 = 3.0v
+    adc_on();
+    
+    uint8_t Vcc = vcc_threshold( vcc_bandgap_mv , readVcc() ) / 100;      // Vcc now *10, so 30 = 3.0v
+    
+    adc_off();
         
     uint8_t VccT = Vcc/10;          // Break out high and low digits
     
@@ -1011,11 +1913,53 @@ static void __attribute__ ((unused)) debugBlinkVoltage(void) {
         
     debugBlinkDigit(VccB);
     
-    _delay_ms(1000);        // Break between readings
+    sleepMs(1000);        // Break between readings
                 
 }  
 
+// The bottom of the run() loop. Sleep until it is time to go round again: through the rest of a seek,
+// then for a while before checking the battery again. A press wakes us and gets straight out, so the
+// next time round sees the button still down. Sleeping on with it held would only wake again for the
+// release, and the press would be lost.
+
+static void idleUntilNext( uint16_t vcc ) {
+
+    // A seek from the press is still sweeping, so sleep through it and unmute when it lands.
+    // A press during it starts the next seek right over this one.
+
+    while (seek_polls && !buttonDown()) {
+
+        sleepFor( SEEK_POLL_HOWLONG );
+
+        seekPoll();
+    }
+
+    if (buttonDown()) {
+        return;
+    }
+
+    // Do nothing for a while before checking low battery again (will wake instantly on button press) to save power
+    // The CPU only used a few microamps for this 8 seconds, which should help extend battery life.
+
+    if ( led_pwm_running() || vcc > vcc_limits.near ) {
+
+        // LED is breathing (so we are stuck in idle sleep and want to get back to power down soon after it stops),
+        // or battery is close enough to worry about.
+        // Since every low sample is also below NEAR, the warm_low_count readings are always 1 second apart.
+
+        sleepFor( HOWLONG_1S );
+
+    } else {
+
+        sleepFor( HOWLONG_8S );     // Nothing happening, this is the longest the watchdog timer can sleep for
+
+    }
+}
+
 void run(void) {
+    
+    PROFILE_BOOT_BEGIN();
+    
     SBI( PORTB , FMIC_RESET_BIT );     // Bring FMIC and AMP out of reset
     // The bit direction was set to output when we first started in main()
     
@@ -1023,21 +1967,38 @@ void run(void) {
                                        // high) does not occur within 300 ns before the rising edge of RST.
     
         
+    PROFILE_BEGIN( PROFILE_INIT );
+    
     si4702_init();
     
-    // We do a check here because init on FM_IC takes 500ms, so by the time we get here
+    PROFILE_END( PROFILE_INIT );
+    
+    // We do a check here because init on FM_IC takes 600ms, so by the time we get here
     // power has stabilized but we do want to check before the amp starts playing music.
 
+    PROFILE_BEGIN( PROFILE_ADC );
+    
     adc_on();
     
-    if (VCC_LESS_THAN( LOW_BATTERY_VOLTAGE_COLD )) {
+    uint16_t boot_vcc = readVcc();
+    
+    adc_off();                  // Left on it would draw through every power down sleep, so only on for each reading
+    
+    PROFILE_END( PROFILE_ADC );
+    
+    TELEMETRY_COUNT( TELEMETRY_BOOT );
+    TELEMETRY_VCC( boot_vcc );
+    
+    if (boot_vcc > vcc_limits.cold) {
+        
+        // No telemetry save down here, this is the brown out range. So a shutdown at power up is never
+        // counted, since we never run again on this battery to save it later.
         
+        PROFILE_SAVE( EEPROM_PROFILE );
 
         // Disable FMIC and AMP
         CBI( PORTB , FMIC_RESET_BIT);    // drive reset low, makes them sleep. DDR is set output on start-up and never changed.
         
-        adc_off();
-        
         lowBatteryShutdown();
         
         return;
@@ -1045,25 +2006,57 @@ void run(void) {
     }        
         
             
+    PROFILE_BEGIN( PROFILE_ENABLE );
+    
     si4702_enable();            // Finish bringing up the FM_IC (it will still be muted)
     
-    uint16_t chan = eeprom_read_word(EEPROM_CHANNEL);       // Assumes this does not have bit 15 set.
+    PROFILE_END( PROFILE_ENABLE );
+    
+    uint16_t chan = params.channel;       // Assumes this does not have bit 15 set.
 
     si4702_tune( chan );        // Tune up the programmed station and start playing
         
     // Radio is now on and tuned
     
-    uint8_t ledCountdown = LED_COUNT;         // Count down how long LED is displayed. When this gets to 0, stop showing LED until a button push resets count
+    PROFILE_BOOT_END();
+    PROFILE_SAVE( EEPROM_PROFILE );
+    
+    #ifdef TELEMETRY
+        blankTornSlots();       // Vcc is good for EEPROM writes now, see find_working_param()
+    #endif
+    
+    TELEMETRY_SAVE();           // Once a boot, after the audio is on so it does not hold that up
+    
+    // Breathe the LED so user knows we are alive in case not tuned to a good station or volume too low.
+    // Brighter breaths for a stronger station. The LED engine stops by itself after LED_COUNT breaths.
+    // The last read of register 0x0A (waiting for the tune) has the RSSI in the low byte.
+    
+    led_pwm_breathe( LED_COUNT , LED_RSSI_DUTY( shadow[REGISTER_0A + 1] ) );
     
     uint8_t warm_low_count=0;                    // How many times in a row has the warm voltage been too low?
     
+    uint8_t low_battery_unsaved=0;               // Came back from a standby, so save the count on the next good reading
+    
     while (1) {
         
-        // This loop cycles every second 
+        // This loop cycles every second while there is something to do (LED showing or battery getting low)
+        // and every 8 seconds the rest of the time. 
                 
         // Constantly check battery and shutdown if low
+        
+        PROFILE_BEGIN( PROFILE_ADC );
+        
+        adc_on();                           // Settles the bandgap asleep, ~1ms
+        
+        uint16_t vcc = readVcc();           // Note bigger values are lower Vcc, see VccADC.h
+        
+        adc_off();
+        
+        TELEMETRY_VCC( vcc );
+        
+        PROFILE_END( PROFILE_ADC );
                 
-        if  (VCC_LESS_THAN( LOW_BATTERY_VOLTAGE_WARM )) {
+        if  (vcc > vcc_limits.warm) {
             
             warm_low_count++;
             
@@ -1072,16 +2065,20 @@ void run(void) {
                 // Only shutdown if we see a consecutive series of low voltage samples to avoid
                 // false alarm due to temp low voltage from a current spike.
                 
-                // Disable FMIC and AMP
-                CBI( PORTB , FMIC_RESET_BIT);    // drive reset low, makes them sleep. DDR is set output on start-up and never changed.
-                                               
-                adc_off();
+                // Counted in RAM only, no EEPROM writes this low. If the battery never comes back, neither
+                // does the count.
                 
-                LED_off();        // Turn off LED PWM
+                TELEMETRY_COUNT( TELEMETRY_LOW_BATTERY );
                 
-                lowBatteryShutdown();
+                PROFILE_SAVE( EEPROM_PROFILE );     // Timer0 gets powered down in standby, so this is the last good snapshot
                 
-                return;
+                lowBatteryStandby();        // Turns off LED PWM too. Only returns if the battery came back and we are playing again.
+                
+                warm_low_count = 0;
+                
+                low_battery_unsaved = 1;
+                
+                led_pwm_breathe( LED_COUNT , LED_RSSI_DUTY( shadow[REGISTER_0A + 1] ) );    // Same hello as a cold start
                 
             }                
                 
@@ -1093,42 +2090,33 @@ void run(void) {
             
             warm_low_count=0;
             
+            if (low_battery_unsaved) {
+                
+                TELEMETRY_SAVE();
+                
+                low_battery_unsaved = 0;
+            }
+            
         }
                 
         
         if (buttonDown()) {
             
+            PROFILE_BEGIN( PROFILE_BUTTON );
+            
             handleButtonDown();
             
+            PROFILE_END( PROFILE_BUTTON );
+            PROFILE_SAVE( EEPROM_PROFILE );
+            
             // Every time the button is pressed we start the LED light countdown over
             // !! commenting out to avoid turning the LED on ever time we change stations
             
-            // ledCountdown = LED_COUNT;
+            // led_pwm_breathe( LED_COUNT , LED_RSSI_DUTY( shadow[REGISTER_0A + 1] ) );
             
         }
         
-        
-        // Light LED so user knows we are alive in case not tuned to a good station or volume too low
-        // Each pass though the while loop in this stage takes about 20ms
-
-        
-        if (ledCountdown) {
-            
-            LED_on();               // Blindly turn on even though might already be on becuase it takes longer to check than do
-                        
-            ledCountdown--;
-            
-            if (!ledCountdown) {
-                
-                LED_off();
-                
-            }  
-            
-        }               
-            
-        sleepFor( HOWLONG_1S );      // Do nothing for a while before checking low battery again (will wake instantly on button press) to save power
-        // We actually do not need to check the battery this often, this is just the longest the watchdog timer can sleep for
-        // The CPU only used a few microamps for this 8 seconds, which should help extend battery life.
+        idleUntilNext( vcc );
             
                 
     }
@@ -1136,6 +2124,12 @@ void run(void) {
 
 
 int main(void) {
+    
+    power_init();               // Everything in PRR off until someone needs it
+    
+    PROFILE_START();
+    
+    TELEMETRY_LOAD( EEPROM_TELEMETRY );     // Before anything gets a chance to count
            
     // Set up the reset line to the FM_IC and AMP first so they are quiet. 
     // This eliminates the need for the external pull-down on this line. 
@@ -1145,7 +2139,7 @@ int main(void) {
 	SBI( DDRB , LED_DRIVE_BIT);    // Set LED pin to output, will default to low (LED off) on startup
                                    // Keeps input pin from floating and toggling unnecessarily and wasting power
                                        
-    _delay_ms(50);                 // Debounce the on switch
+    sleepMs(50);                   // Debounce the on switch
         
     // TODO: Test shutdown current on a new PCB that lets us hold the amp in reset
                                                                                                                             
@@ -1159,20 +2153,24 @@ int main(void) {
         
         // Wait for release
         
-        while (buttonDown());
+        buttonWaitUp();
                             
-        copy_factory_param();       // Revert to initial config
-        
-        longBlink();
+        factoryReset();
         
         // Factory config now loaded into working config. Continue as you were...        
                         
     }   
+
+    #ifdef VCCPROG
+        jig_program();              // Only does anything on the 5V jig
+    #endif
                           
     // Now lets check if the working EEPROM settings are corrupted
     // We do this *after* the factory reset test, see why?
     
-    if (check_param_crc( EEPROM_WORKING )) {
+    load_vcc_limits();
+    
+    if (find_working_param()) {
         
         // Must be inside a nuclear power reactor...
         
@@ -1180,6 +2178,25 @@ int main(void) {
         // This is nice because at least we get some feedback that EEPROMS are corrupting.
         // Do not try to rewrite EEPROM settings, let the user do that manually with a factory reset.
         
+        // We never get to run(), so save what telemetry found here, if the battery is good for it.
+        
+        #ifdef TELEMETRY
+        
+            adc_on();
+            
+            uint16_t vcc = readVcc();
+            
+            adc_off();
+            
+            TELEMETRY_VCC( vcc );
+            
+            if (vcc <= vcc_limits.cold) {
+                blankTornSlots();
+                TELEMETRY_SAVE();
+            }
+            
+        #endif
+        
         badEEPROMBlink();
                 
     }        
@@ -5,10 +5,9 @@
 
 void setup() {
 
-// Pins A0, A1, and A2 used to power the attached TPR
+// Each attached TPR is powered from its own group of pins, see units[]
   
-  DDRC  = 0b00000111;       // Output
-  PORTC = 0b00000111;       // Drive output pins high
+  setupUnits();
   
   Serial.begin(9600);
   while (! Serial); // Wait until Serial is ready 
@@ -58,103 +57,475 @@ void setup() {
  *  
  *  TODO: Add hystereis to voltage thresholds?
  *  TODO: Make voltage levels relative rather than absolutle?
+ *  
+ *  Parameter frames
+ *  ----------------
+ *  
+ *  The bit-per-two-pulses frames above are slow (20ms a bit), so they only have room for the
+ *  channel. A parameter frame sends the whole 16 byte EEPROM parameter block in about 0.4s instead.
+ *  
+ *  Since only the falling edges matter, a short dip is plenty, and each dip carries 2 bits in how
+ *  long after the previous dip it comes: DENSE_BASE_US + n * DENSE_STEP_US for n = 0-3.
+ *  A frame is a start dip followed by one dip per 2 bits, MSB first. The TPR tells the two kinds of
+ *  frame apart by the time between the first two dips, which is always under 10ms here.
+ *  
+ *  Answers
+ *  -------
+ *  
+ *  After each frame the TPR answers by turning its LED on, which we see as a droop on the pins
+ *  powering it. 40ms of load is an ACK: the block is in EEPROM and reads back good, and the TPR
+ *  goes on to boot. 10ms is a NAK: it heard a frame but could not use it, and is still listening.
+ *  No answer at all means it missed the frame, or was not listening yet.
+ *  
+ *  These timings must match VccProg.h in the firmware.
  * 
  */
 
+#define DENSE_DIP_US     500
+#define DENSE_BASE_US   4000
+#define DENSE_STEP_US   1250
+
+#define ACK_MS            40
+#define NAK_MS            10
+
+
+/**
+ *  Multi-unit programming
+ *  ======================
+ *  
+ *  Each TPR gets its own group of 3 pins on one port, switched together with a single masked write.
+ *  Nothing here blocks: every unit has its own little sender that knows when its next pin change
+ *  is due, and programUnits() just keeps polling micros() and stepping whichever units are due. So
+ *  the units run side by side, and a lot of N units takes about as long as one.
+ *  
+ *  Timings are tracked from when each step was due rather than when we got to it, so a late
+ *  step never pushes the rest of the frame later.
+ *  
+ *  Each unit also has an analog pin wired to its supply, so we can hear its answer. For the units
+ *  on PORTC that is just one of its own pins, since the ADC reads a pin even while it is an output.
+ *  The units on PORTD need A6 and A7 wired across to their supply pins. After a frame we listen to
+ *  every unit at once, and only the ones that did not ACK get the frame again, up to SEND_TRIES times.
+ *  
+ *  A TPR only listens for VCCPROG_LISTEN_S (10s) after it powers up, and the sockets are powered from
+ *  setup() on, so a unit loaded a while before Enter has long since booted. So first we power cycle
+ *  every unit we are about to send to, and again before each retry any unit that did not answer at
+ *  all. A unit that NAKed is still listening, so it is left alone.
+ */
+
+#define LEGACY_DIP_US     1000
+#define LEGACY_BIT_US    10000          // Sync to data, data to next sync. A 0 is 2 of these with no data dip.
 
-void sendbit(int b) {
+#define FRAME_GAP_MS        50          // Quiet before each frame. After it we listen for LISTEN_MS, which is longer.
 
-    PORTC = 0b00000000;         // Send sync pulse
-    delay(1);
-    PORTC = 0b00000111;
-    delay(9);
+#define FRAME_MAX           16
 
-     
-    if (b) {
+#define SEND_TRIES           3
 
-      PORTC = 0b00000000;
-      delay(1);
-      PORTC = 0b00000111;
-      delay(9);
+#define POWER_OFF_MS       300          // Long enough for the unit's supply caps to discharge and the ATtiny to reset
+#define POWER_BOOT_MS      250          // Start-up time, the firmware's 50ms debounce, and the receiver starting
 
-    } else {
+#define LISTEN_MS          400          // Longest a TPR takes to answer, frame gap and EEPROM writes included
+#define LOAD_DROP            8          // ADC counts (~40mV) below the settled supply that means the LED is on. Depends on the LED resistor.
+#define ANSWER_MIN_MS        3          // Shorter than this is noise
+#define ANSWER_SPLIT_MS     ( ( ACK_MS + NAK_MS ) / 2 )
+
+typedef struct {
+  volatile uint8_t *port;
+  volatile uint8_t *ddr;
+  uint8_t mask;
+  uint8_t sense;                        // Analog pin that sees the unit's supply
+  const char *pins;
+} unit_pins;
+
+// Add more here if you need them, PORTB has room for 2 more. Leave D0/D1 alone, they are the serial port.
+
+const unit_pins units[] = {
+  { &PORTC , &DDRC , 0b00000111 , A0 , "A0-A2" },
+  { &PORTC , &DDRC , 0b00111000 , A3 , "A3-A5" },
+  { &PORTD , &DDRD , 0b00011100 , A6 , "D2-D4" },
+  { &PORTD , &DDRD , 0b11100000 , A7 , "D5-D7" },
+};
+
+#define UNIT_COUNT ( sizeof( units ) / sizeof( units[0] ) )
+
+typedef enum { S_IDLE , S_LEAD , S_DIP , S_WAIT } sender_state;
+
+typedef enum { A_NONE , A_ACK , A_NAK } unit_answer;
+
+typedef struct {
+  sender_state state;
+  unsigned long due;                    // micros() when the next step is due
+  unsigned long dip_start;              // When the current dip was due to start
+  unsigned long started;
+  unsigned long took;                   // Last frame, lead gap to the end of the last dip, in us
+  uint16_t pos;                         // Legacy: dips sent, Dense: symbols sent
+  uint8_t tries;                        // Times we sent the frame
+  unit_answer answer;                   // What it said to the last one
+  int settled;                          // Highest supply reading since the frame, the unloaded level
+  unsigned long load_start;             // When the load came on, 0 while it is off
+} sender;
+
+sender senders[ UNIT_COUNT ];
+
+// The frame every unit is sending. They all send the same one, just not necessarily in step.
+
+uint8_t frame[ FRAME_MAX ];
+uint8_t frame_len;
+uint8_t frame_legacy;
+
+uint8_t units_enabled = ( 1 << UNIT_COUNT ) - 1;
+
+void setupUnits() {
+
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+    *units[u].port |= units[u].mask;      // Pull-up first so we never glitch the power off...
+    *units[u].ddr  |= units[u].mask;      // ...then make them outputs, driving high
+  }
+
+}
+
+static void unitPins( uint8_t u , uint8_t high ) {
+
+  if (high) {
+    *units[u].port |= units[u].mask;
+  } else {
+    *units[u].port &= ~units[u].mask;
+  }
+
+}
+
+// Power cycle every unit in mask at once, and wait for them to boot up and start listening
+
+static void powerCycleUnits( uint8_t mask ) {
 
-      delay(10);
-     
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+    if (mask & ( 1 << u )) unitPins( u , 0 );
+  }
+
+  delay( POWER_OFF_MS );
+
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+    if (mask & ( 1 << u )) unitPins( u , 1 );
+  }
+
+  delay( POWER_BOOT_MS );
+
+}
+
+// How long from the start of dip number pos to the start of the next one, or 0 if it is the last dip of the frame
+
+static unsigned long nextInterval( uint16_t pos ) {
+
+  if (frame_legacy) {
+
+    // Walk the bits to see whether dip pos is a sync or a data dip. Frames are only 32 bits, so this is cheap enough.
+
+    uint16_t dip = 0;
+
+    for( uint16_t bit=0; bit < frame_len * 8 ; bit++ ) {
+
+      uint8_t one = ( frame[ bit / 8 ] >> ( 7 - ( bit % 8 ) ) ) & 1;
+      uint8_t last = ( bit == ( frame_len * 8 ) - 1 );
+
+      if (dip == pos) {                               // Sync for this bit
+        if (one) return LEGACY_BIT_US;
+        return last ? 0 : 2 * LEGACY_BIT_US;
+      }
+
+      dip++;
+
+      if (one) {
+        if (dip == pos) {                             // Data dip for this bit
+          return last ? 0 : LEGACY_BIT_US;
+        }
+        dip++;
+      }
     }
 
+    return 0;
+
+  }
+
+  if (pos >= frame_len * 4) {
+    return 0;                                         // The dip that ends the last interval
+  }
+
+  uint8_t n = ( frame[ pos / 4 ] >> ( 6 - ( 2 * ( pos % 4 ) ) ) ) & 0x03;
+
+  return DENSE_BASE_US + ( n * DENSE_STEP_US );
+
 }
 
+static void stepUnit( uint8_t u ) {
+
+  sender *s = &senders[u];
+
+  switch ( s->state ) {
+
+    case S_LEAD:
+    case S_WAIT:
+      unitPins( u , 0 );
+      s->dip_start = s->due;
+      s->due += frame_legacy ? LEGACY_DIP_US : DENSE_DIP_US;
+      s->state = S_DIP;
+      break;
+
+    case S_DIP: {
+      unitPins( u , 1 );
+      unsigned long interval = nextInterval( s->pos++ );
+      if (interval) {
+        s->due = s->dip_start + interval;
+        s->state = S_WAIT;
+      } else {
+        s->took = s->due - s->started;        // The gap after is the time we listen for the answer
+        s->state = S_IDLE;
+      }
+      break;
+    }
 
-void sendbyte(uint8_t b) {
+    default:
+      break;
 
-  //Serial.print("XMIT:");
-  //Serial.print(b,HEX);
-  //Serial.println("");
+  }
 
-  int bitmask=0b10000000;
+}
 
-  while (bitmask) {
+// Send the frame to every unit in mask at once. Returns when they are all done.
 
-    if (bitmask&b) {
-      sendbit(1);
+void programUnits( uint8_t mask ) {
+
+  unsigned long now = micros();
+
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+
+    sender *s = &senders[u];
+
+    s->took = 0;
+
+    if (mask & ( 1 << u )) {
+      s->tries++;
+      s->state = S_LEAD;
+      s->started = now;
+      s->due = now + ( FRAME_GAP_MS * 1000UL );
+      s->pos = 0;
     } else {
-      sendbit(0);
+      s->state = S_IDLE;
     }
+  }
+
+  uint8_t busy;
+
+  do {
+
+    busy = 0;
+    now = micros();
 
-    bitmask >>=1;
-   
+    for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+
+      if (senders[u].state != S_IDLE) {
+
+        if ((long) ( now - senders[u].due ) >= 0) {
+          stepUnit( u );
+        }
+
+        busy = 1;
+      }
+    }
+
+  } while (busy);
+
+}
+
+// Listen to every unit in mask for its answer to the frame we just sent. Returns the units that ACKed.
+// The supply is still recovering from the last dip when we start, so the unloaded level is the highest
+// reading so far, and the load is anything LOAD_DROP below that. It has to go off again before we
+// call it, or we could not tell an ACK from a NAK, and that is also why the TPR waits before booting.
+
+uint8_t listenUnits( uint8_t mask ) {
+
+  unsigned long start = millis();
+  uint8_t waiting = mask;
+
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+    senders[u].answer = A_NONE;
+    senders[u].settled = 0;
+    senders[u].load_start = 0;
+  }
+
+  while (waiting && ( millis() - start ) < LISTEN_MS) {
+
+    for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+
+      if (!( waiting & ( 1 << u ) )) {
+        continue;
+      }
+
+      sender *s = &senders[u];
+
+      int v = analogRead( units[u].sense );
+      unsigned long now = millis() | 1;       // Never 0, that means off
+
+      if (!s->load_start) {
+
+        if (v > s->settled) {
+          s->settled = v;
+        } else if (v + LOAD_DROP < s->settled) {
+          s->load_start = now;
+        }
+
+      } else if (v + ( LOAD_DROP / 2 ) >= s->settled) {     // Off again, with some hysteresis
+
+        unsigned long ms = now - s->load_start;
+
+        s->load_start = 0;
+
+        if (ms >= ANSWER_SPLIT_MS) {
+          s->answer = A_ACK;
+        } else if (ms >= ANSWER_MIN_MS) {
+          s->answer = A_NAK;
+        }
+
+        if (s->answer != A_NONE) {
+          waiting &= ~( 1 << u );
+        }
+      }
+    }
+  }
+
+  uint8_t acked = 0;
+
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+    if (( mask & ( 1 << u ) ) && senders[u].answer == A_ACK) {
+      acked |= ( 1 << u );
+    }
+  }
+
+  return acked;
+
+}
+
+// Send the frame until every enabled unit has ACKed it, or they have all had SEND_TRIES goes.
+// Units are power cycled first so they are listening, see above. Returns the units that never ACKed.
+
+uint8_t sendUnits() {
+
+  uint8_t pending = units_enabled;
+
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+    senders[u].tries = 0;
+  }
+
+  uint8_t silent = pending;             // Units that may not be listening, every one to start with
+
+  for( uint8_t t=0; t<SEND_TRIES && pending; t++ ) {
+
+    powerCycleUnits( silent );
+
+    programUnits( pending );
+    pending &= ~listenUnits( pending );
+
+    silent = 0;
+    for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+      if (( pending & ( 1 << u ) ) && senders[u].answer == A_NONE) {
+        silent |= ( 1 << u );
+      }
+    }
   }
 
-      
+  return pending;
+
+}
+
+void reportUnits() {
+
+  for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+
+    Serial.print( "  unit " );
+    Serial.print( u );
+    Serial.print( " (" );
+    Serial.print( units[u].pins );
+    Serial.print( "): " );
+
+    if (units_enabled & ( 1 << u )) {
+      Serial.print( "sent " );
+      Serial.print( frame_len );
+      Serial.print( " bytes in " );
+      Serial.print( senders[u].took / 1000 );
+      Serial.print( "ms x" );
+      Serial.print( senders[u].tries );
+      switch ( senders[u].answer ) {
+        case A_ACK: Serial.println( ", OK" ); break;
+        case A_NAK: Serial.println( ", FAILED (rejected)" ); break;
+        default:    Serial.println( ", FAILED (no answer)" ); break;
+      }
+    } else {
+      Serial.println( "skipped" );
+    }
+  }
 
 }
 
-void sendpacket( uint16_t channel  , uint8_t band, uint8_t deemphassis , uint8_t spacing ) {
+// Only the channel and its CRC fit in a reasonable time with the original frames
+
+void framepacket( uint16_t channel ) {
 
   uint16_t crc = 0x0000;
 
-  sendbyte( channel >> 8 );  
-  crc = _crc16_update(crc, channel>>8 );   
-            
-  sendbyte( channel & 0xff );
-  crc = _crc16_update(crc, channel & 0xff );    
+  crc = _crc16_update(crc, channel >> 8 );
+  crc = _crc16_update(crc, channel & 0xff );
 
-/*
+  frame[0] = channel >> 8;
+  frame[1] = channel & 0xff;
+  frame[2] = crc >> 8;
+  frame[3] = crc & 0xff;
 
+  frame_len = 4;
+  frame_legacy = 1;
 
-  sendbyte( deemphassis );
-  crc = _crc16_update(crc, deemphassis );  
+}
 
+// A whole parameter block, laid out exactly as eeprom.py packs it ('<BBBHB8x' then CRC-16 low byte first)
 
-  sendbyte( band );
-  crc = _crc16_update(crc, band );    
+void frameparams( uint16_t channel  , uint8_t band, uint8_t deemphassis , uint8_t spacing , uint8_t volume ) {
 
-  
+  const uint8_t block[16] = { band , deemphassis , spacing , (uint8_t) (channel & 0xff) , (uint8_t) (channel >> 8) , volume };   // Rest 0
 
-  sendbyte( spacing );
-  crc = _crc16_update(crc, spacing );    
+  uint16_t crc = 0x0000;
+
+  for( uint8_t i=0; i<14; i++ ) {
+    frame[i] = block[i];
+    crc = _crc16_update(crc, block[i] );
+  }
 
-  */
+  frame[14] = crc & 0xff;
+  frame[15] = crc >> 8;
+
+  frame_len = 16;
+  frame_legacy = 0;
 
-  sendbyte( crc >> 8 );
-  sendbyte( crc & 0xff );
-      
 }
 
-void sendprogramming( float station  , uint8_t band, uint8_t deemphassis , uint8_t spacing ) {
+// Returns the units that never ACKed
+
+uint8_t sendprogramming( float station  , uint8_t band, uint8_t deemphassis , uint8_t spacing , uint8_t volume , uint8_t legacy ) {
 
   const float base[]  = { 87.5, 76, 76};            // Base freqenecy based on band
   const float step[] = {  0.20 , 0.10 , 0.05 };     // Freqnecy step based on spacing
 
   Serial.print(" computed channel=");
 
-  uint16_t channel  = (uint16_t) ((station - base[band]) / step[ spacing] );
+  uint16_t channel  = (uint16_t) (((station - base[band]) / step[ spacing] ) + 0.5);    // Round, 101.1 would truncate to 67.99999
 
   Serial.print( channel );
   Serial.print( "..." );
 
-  sendpacket( channel , band, deemphassis , spacing ); 
+  if (legacy) {
+    framepacket( channel ); 
+  } else {
+    frameparams( channel , band, deemphassis , spacing , volume ); 
+  }
+
+  return sendUnits();
 
 }
 
@@ -203,6 +574,7 @@ void loop() {
   uint8_t band =0;
   uint8_t deemphassis=0;
   uint8_t spacing =0;
+  uint8_t volume =15;                 // Max volume, same default as eeprom.py. Channel only frames keep the unit's own.
   
 
   while (1) {
@@ -226,9 +598,20 @@ void loop() {
     Serial.print(spacing);
     Serial.println("]");
 
+    Serial.print("V-Volume     [");
+    Serial.print(volume);
+    Serial.println("]");
+
+    Serial.print("U-Units      [");           // One digit per unit, 1=program it
+    for( uint8_t u=0; u<UNIT_COUNT; u++ ) {
+      Serial.print( ( units_enabled & ( 1 << u ) ) ? '1' : '0' );
+    }
+    Serial.println("]");
+
 
     Serial.println("");
     Serial.println("ENTER-Program it!");
+    Serial.println("L-Program channel only (slow)");
     
     char buffer[BUFFER_LEN];
 
@@ -243,8 +626,22 @@ void loop() {
         case 0x00:
 
           Serial.print("Programming...");
-          sendprogramming( station  , band, deemphassis , spacing );
-          Serial.println("done.");
+          Serial.println( sendprogramming( station  , band, deemphassis , spacing , volume , 0 ) ? "FAILED." : "done." );
+          reportUnits();
+          break;
+
+        case 'L':
+          Serial.print("Programming channel...");
+          Serial.println( sendprogramming( station  , band, deemphassis , spacing , volume , 1 ) ? "FAILED." : "done." );
+          reportUnits();
+          break;
+
+        case 'U':
+          units_enabled = 0;
+          for( uint8_t u=0; u<UNIT_COUNT && buffer[u+1]; u++ ) {
+            if (buffer[u+1]=='1') units_enabled |= ( 1 << u );
+          }
+          Serial.println("Units set.");
           break;
           
         case 'S':
@@ -253,20 +650,25 @@ void loop() {
           break;
 
         case 'B':
-          band=buffer[0]-'0';
+          band=buffer[1]-'0';
           Serial.println("Band set.");
           break;
 
         case 'D':
-          deemphassis=buffer[0]-'0';
+          deemphassis=buffer[1]-'0';
           Serial.println("Deemphassis set.");
           break;
 
         case 'P':
-          spacing=buffer[0]-'0';
+          spacing=buffer[1]-'0';
           Serial.println("Spacing set.");
           break;
 
+        case 'V':
+          volume=String(buffer+1).toInt();
+          Serial.println("Volume set.");
+          break;
+
 
        default:
           Serial.print("Don't understand [");